@@ -1,10 +1,13 @@
 #include "Canvas.h"
 
 #include "MapHelper.hpp"
+#include "ShaderMacroHelper.hpp"
 
 #include "juniper/AppGlobal.h"
 #include "juniper/FileWatch.h"
 
+#include <algorithm>
+
 using namespace juniper;
 using namespace Diligent;
 
@@ -13,10 +16,37 @@ namespace {
 FileWatchHandle         ShadersDirWatchHandle;
 bool                    ShaderAssetsMarkedDirty = false;
 
+// also bound to the pixel shader as CanvasConstants
 struct VertexConstants {
     float2 center;
     float2 size;
+    Uint32 frameIndex; // counts the frames the pixel shader ran
+    Uint32 padding;
+    float2 targetSize; // of the low res targets, zero when drawing directly
+};
+static_assert( sizeof(VertexConstants) % 16 == 0, "must be aligned to 16 bytes" );
+
+// matches canvas_upsample.psh
+struct UpsampleConstants {
+    float2 lowResSize;
+    float2 lowResScale;
 };
+static_assert( sizeof(UpsampleConstants) % 16 == 0, "must be aligned to 16 bytes" );
+
+constexpr TEXTURE_FORMAT LowResDepthFormat = TEX_FORMAT_RG32_FLOAT; // x: distance along the view ray, y: normalized device depth
+constexpr Uint32 TemporalRefreshFrames = 16; // matches the 4x4 refresh pattern in canvasRaymarcher.psh
+constexpr Uint32 ConeTileSize = 8; // low res pixels per cone prepass texel along each axis, passed to the shader as CANVAS_CONE_TILE
+constexpr TEXTURE_FORMAT ConeDistanceFormat = TEX_FORMAT_R32_FLOAT;
+
+// FNV-1a
+size_t HashBytes( const void* data, size_t size, size_t hash = 14695981039346656037ull )
+{
+    auto bytes = static_cast<const Uint8*>( data );
+    for( size_t i = 0; i < size; i++ ) {
+        hash = ( hash ^ bytes[i] ) * 1099511628211ull;
+    }
+    return hash;
+}
 
 }// anon
 
@@ -41,6 +71,15 @@ Canvas::Canvas( size_t sizePixelConstants )
         CBDesc.CPUAccessFlags = CPU_ACCESS_WRITE;
         global()->renderDevice->CreateBuffer( CBDesc, nullptr, &mPixelConstants );
     }
+    {
+        BufferDesc CBDesc;
+        CBDesc.Name           = "UpsampleConstants Buffer";
+        CBDesc.Size           = sizeof(UpsampleConstants);
+        CBDesc.Usage          = USAGE_DYNAMIC;
+        CBDesc.BindFlags      = BIND_UNIFORM_BUFFER;
+        CBDesc.CPUAccessFlags = CPU_ACCESS_WRITE;
+        global()->renderDevice->CreateBuffer( CBDesc, nullptr, &mUpsampleConstants );
+    }
 
 	initPipelineState();
 	watchShadersDir();
@@ -48,6 +87,13 @@ Canvas::Canvas( size_t sizePixelConstants )
 
 void Canvas::initPipelineState()
 {
+    mPSO.Release();
+    mSRB.Release();
+    mLowResPSO.Release();
+    mConePSO.Release();
+    mConeSRB.Release();
+    mUpsamplePSO.Release();
+
     GraphicsPipelineStateCreateInfo PSOCreateInfo;
     PSOCreateInfo.PSODesc.Name                                  = "Canvas PSO";
     PSOCreateInfo.PSODesc.PipelineType                          = PIPELINE_TYPE_GRAPHICS;
@@ -107,8 +153,225 @@ void Canvas::initPipelineState()
         if( pc ) {
             pc->Set( mPixelConstants );
         }
+        if( auto cc = mPSO->GetStaticVariableByName( SHADER_TYPE_PIXEL, "CanvasConstants" ) ) {
+            cc->Set( mVertexConstants );
+        }
         mPSO->CreateShaderResourceBinding( &mSRB, true );
     }
+
+    // reduced resolution: the same pixel shader writes color and depth to two render targets, without depth testing
+    RefCntAutoPtr<IShader> pLowResPS;
+    {
+        ShaderMacroHelper macros;
+        macros.AddShaderMacro( "CANVAS_LOW_RES", 1 );
+        macros.AddShaderMacro( "CANVAS_TEMPORAL", mTemporalCache ? 1 : 0 );
+        macros.AddShaderMacro( "CANVAS_CONE_START", mConePrepass ? 1 : 0 );
+        macros.AddShaderMacro( "CANVAS_CONE_TILE", int( ConeTileSize ) );
+        macros.Finalize();
+
+        ShaderCI.Desc.ShaderType = SHADER_TYPE_PIXEL;
+        ShaderCI.EntryPoint      = "main";
+        ShaderCI.Desc.Name       = "Canvas Low Res PS";
+        ShaderCI.FilePath        = "shaders/canvas/canvasRaymarcher.psh";
+        ShaderCI.Macros          = macros;
+        global()->renderDevice->CreateShader( ShaderCI, &pLowResPS );
+        ShaderCI.Macros          = {};
+    }
+
+    PSOCreateInfo.PSODesc.Name                                  = "Canvas Low Res PSO";
+    PSOCreateInfo.GraphicsPipeline.NumRenderTargets             = 2;
+    PSOCreateInfo.GraphicsPipeline.RTVFormats[1]                = LowResDepthFormat;
+    PSOCreateInfo.GraphicsPipeline.DSVFormat                    = TEX_FORMAT_UNKNOWN;
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthEnable = False;
+    PSOCreateInfo.pPS = pLowResPS;
+
+    // history textures are only declared with CANVAS_TEMPORAL, the cone distances with CANVAS_CONE_START
+    ShaderResourceVariableDesc lowResVars[] = {
+        { SHADER_TYPE_PIXEL, "CanvasHistoryColor", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE },
+        { SHADER_TYPE_PIXEL, "CanvasHistoryDepth", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE },
+        { SHADER_TYPE_PIXEL, "CanvasConeDistance", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE }
+    };
+    PSOCreateInfo.PSODesc.ResourceLayout.Variables    = lowResVars;
+    PSOCreateInfo.PSODesc.ResourceLayout.NumVariables = _countof(lowResVars);
+
+    global()->renderDevice->CreateGraphicsPipelineState( PSOCreateInfo, &mLowResPSO );
+    if( mLowResPSO ) {
+        if( auto vc = mLowResPSO->GetStaticVariableByName( SHADER_TYPE_VERTEX, "Constants" ) ) {
+            vc->Set( mVertexConstants );
+        }
+        if( auto pc = mLowResPSO->GetStaticVariableByName( SHADER_TYPE_PIXEL, "Constants" ) ) {
+            pc->Set( mPixelConstants );
+        }
+        if( auto cc = mLowResPSO->GetStaticVariableByName( SHADER_TYPE_PIXEL, "CanvasConstants" ) ) {
+            cc->Set( mVertexConstants );
+        }
+    }
+
+    // cone prepass: coneMain() writes how far each tile of the low res pass can skip before sphere tracing
+    if( mConePrepass ) {
+        RefCntAutoPtr<IShader> pConePS;
+        {
+            ShaderMacroHelper macros;
+            macros.AddShaderMacro( "CANVAS_CONE_TILE", int( ConeTileSize ) );
+            macros.Finalize();
+
+            ShaderCI.Desc.ShaderType = SHADER_TYPE_PIXEL;
+            ShaderCI.EntryPoint      = "coneMain";
+            ShaderCI.Desc.Name       = "Canvas Cone Prepass PS";
+            ShaderCI.FilePath        = "shaders/canvas/canvasRaymarcher.psh";
+            ShaderCI.Macros          = macros;
+            global()->renderDevice->CreateShader( ShaderCI, &pConePS );
+            ShaderCI.Macros          = {};
+        }
+
+        PSOCreateInfo.PSODesc.Name                                  = "Canvas Cone Prepass PSO";
+        PSOCreateInfo.GraphicsPipeline.NumRenderTargets             = 1;
+        PSOCreateInfo.GraphicsPipeline.RTVFormats[0]                = ConeDistanceFormat;
+        PSOCreateInfo.GraphicsPipeline.RTVFormats[1]                = TEX_FORMAT_UNKNOWN;
+        PSOCreateInfo.PSODesc.ResourceLayout.Variables              = nullptr;
+        PSOCreateInfo.PSODesc.ResourceLayout.NumVariables           = 0;
+        PSOCreateInfo.pPS = pConePS;
+
+        global()->renderDevice->CreateGraphicsPipelineState( PSOCreateInfo, &mConePSO );
+        if( mConePSO ) {
+            if( auto vc = mConePSO->GetStaticVariableByName( SHADER_TYPE_VERTEX, "Constants" ) ) {
+                vc->Set( mVertexConstants );
+            }
+            if( auto pc = mConePSO->GetStaticVariableByName( SHADER_TYPE_PIXEL, "Constants" ) ) {
+                pc->Set( mPixelConstants );
+            }
+            if( auto cc = mConePSO->GetStaticVariableByName( SHADER_TYPE_PIXEL, "CanvasConstants" ) ) {
+                cc->Set( mVertexConstants );
+            }
+            mConePSO->CreateShaderResourceBinding( &mConeSRB, true );
+        }
+    }
+
+    // upsample into the caller's targets, the low res textures are rebound whenever they're recreated
+    RefCntAutoPtr<IShader> pUpsamplePS;
+    {
+        ShaderCI.Desc.ShaderType = SHADER_TYPE_PIXEL;
+        ShaderCI.EntryPoint      = "main";
+        ShaderCI.Desc.Name       = "Canvas Upsample PS";
+        ShaderCI.FilePath        = "shaders/canvas/canvas_upsample.psh";
+        global()->renderDevice->CreateShader( ShaderCI, &pUpsamplePS );
+    }
+
+    PSOCreateInfo.PSODesc.Name                                  = "Canvas Upsample PSO";
+    PSOCreateInfo.GraphicsPipeline.NumRenderTargets             = 1;
+    PSOCreateInfo.GraphicsPipeline.RTVFormats[0]                = global()->colorBufferFormat;
+    PSOCreateInfo.GraphicsPipeline.RTVFormats[1]                = TEX_FORMAT_UNKNOWN;
+    PSOCreateInfo.GraphicsPipeline.DSVFormat                    = global()->depthBufferFormat;
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthEnable = True;
+    PSOCreateInfo.pPS = pUpsamplePS;
+
+    ShaderResourceVariableDesc upsampleVars[] = {
+        { SHADER_TYPE_PIXEL, "CanvasColor", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE },
+        { SHADER_TYPE_PIXEL, "CanvasDepth", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE }
+    };
+    PSOCreateInfo.PSODesc.ResourceLayout.Variables    = upsampleVars;
+    PSOCreateInfo.PSODesc.ResourceLayout.NumVariables = _countof(upsampleVars);
+
+    global()->renderDevice->CreateGraphicsPipelineState( PSOCreateInfo, &mUpsamplePSO );
+    if( mUpsamplePSO ) {
+        if( auto vc = mUpsamplePSO->GetStaticVariableByName( SHADER_TYPE_VERTEX, "Constants" ) ) {
+            vc->Set( mVertexConstants );
+        }
+        if( auto uc = mUpsamplePSO->GetStaticVariableByName( SHADER_TYPE_PIXEL, "UpsampleConstants" ) ) {
+            uc->Set( mUpsampleConstants );
+        }
+    }
+
+    // SRBs and textures are created on the next render() that upsamples
+    for( int i = 0; i < 2; i++ ) {
+        mLowResSRB[i].Release();
+        mUpsampleSRB[i].Release();
+        mLowResColor[i].Release();
+        mLowResDepth[i].Release();
+    }
+    mConeDistance.Release();
+    mHistoryValid = false;
+}
+
+void Canvas::setTemporalCache( bool enable )
+{
+    if( mTemporalCache == enable ) {
+        return;
+    }
+
+    mTemporalCache = enable;
+    initPipelineState();
+}
+
+void Canvas::setConePrepass( bool enable )
+{
+    if( mConePrepass == enable ) {
+        return;
+    }
+
+    mConePrepass = enable;
+    initPipelineState();
+}
+
+void Canvas::initLowResTargets( Uint32 width, Uint32 height )
+{
+    TextureDesc desc;
+    desc.Type      = RESOURCE_DIM_TEX_2D;
+    desc.Width     = width;
+    desc.Height    = height;
+    desc.MipLevels = 1;
+    desc.BindFlags = BIND_RENDER_TARGET | BIND_SHADER_RESOURCE;
+
+    const int numTargets = mTemporalCache ? 2 : 1;
+    for( int i = 0; i < 2; i++ ) {
+        mLowResColor[i].Release();
+        mLowResDepth[i].Release();
+        mLowResSRB[i].Release();
+        mUpsampleSRB[i].Release();
+        if( i >= numTargets ) {
+            continue;
+        }
+
+        desc.Name   = "Canvas Low Res Color";
+        desc.Format = global()->colorBufferFormat;
+        global()->renderDevice->CreateTexture( desc, nullptr, &mLowResColor[i] );
+
+        desc.Name   = "Canvas Low Res Depth";
+        desc.Format = LowResDepthFormat;
+        global()->renderDevice->CreateTexture( desc, nullptr, &mLowResDepth[i] );
+    }
+
+    mConeDistance.Release();
+    if( mConePrepass ) {
+        desc.Name   = "Canvas Cone Distance";
+        desc.Width  = ( width + ConeTileSize - 1 ) / ConeTileSize;
+        desc.Height = ( height + ConeTileSize - 1 ) / ConeTileSize;
+        desc.Format = ConeDistanceFormat;
+        global()->renderDevice->CreateTexture( desc, nullptr, &mConeDistance );
+    }
+
+    // each set of targets gets SRBs that read the other set as history, so nothing is rebound per frame
+    for( int i = 0; i < numTargets; i++ ) {
+        const int prev = numTargets - 1 - i;
+
+        mLowResPSO->CreateShaderResourceBinding( &mLowResSRB[i], true );
+        if( auto var = mLowResSRB[i]->GetVariableByName( SHADER_TYPE_PIXEL, "CanvasHistoryColor" ) ) {
+            var->Set( mLowResColor[prev]->GetDefaultView( TEXTURE_VIEW_SHADER_RESOURCE ) );
+        }
+        if( auto var = mLowResSRB[i]->GetVariableByName( SHADER_TYPE_PIXEL, "CanvasHistoryDepth" ) ) {
+            var->Set( mLowResDepth[prev]->GetDefaultView( TEXTURE_VIEW_SHADER_RESOURCE ) );
+        }
+        if( auto var = mLowResSRB[i]->GetVariableByName( SHADER_TYPE_PIXEL, "CanvasConeDistance" ) ) {
+            var->Set( mConeDistance->GetDefaultView( TEXTURE_VIEW_SHADER_RESOURCE ) );
+        }
+
+        mUpsamplePSO->CreateShaderResourceBinding( &mUpsampleSRB[i], true );
+        mUpsampleSRB[i]->GetVariableByName( SHADER_TYPE_PIXEL, "CanvasColor" )->Set( mLowResColor[i]->GetDefaultView( TEXTURE_VIEW_SHADER_RESOURCE ) );
+        mUpsampleSRB[i]->GetVariableByName( SHADER_TYPE_PIXEL, "CanvasDepth" )->Set( mLowResDepth[i]->GetDefaultView( TEXTURE_VIEW_SHADER_RESOURCE ) );
+    }
+
+    mHistoryIndex = 0;
+    mHistoryValid = false;
 }
 
 void Canvas::watchShadersDir()
@@ -137,8 +400,6 @@ void Canvas::reloadOnAssetsUpdated()
 {
     LOG_INFO_MESSAGE( __FUNCTION__, "| re-initializing shader assets" );
 
-    mPSO.Release();
-    mSRB.Release();
     initPipelineState();
 
     ShaderAssetsMarkedDirty = false;
@@ -151,15 +412,108 @@ void Canvas::update( double deltaSeconds )
     }
 }
 
-void Canvas::render( IDeviceContext* context, const float4x4 &mvp )
+void Canvas::setPixelConstants( const void* data, size_t size )
+{
+    auto bytes = static_cast<const Uint8*>( data );
+    mPixelConstantsData.assign( bytes, bytes + std::min( size, size_t( mPixelConstants->GetDesc().Size ) ) );
+}
+
+void Canvas::render( IDeviceContext* context, const float4x4 &mvp, ITextureView* rtv, ITextureView* dsv )
 {
+    // the pixel shader only depends on these, together with the textures that invalidate the history when recreated
+    size_t inputsHash = HashBytes( mPixelConstantsData.data(), mPixelConstantsData.size() );
+    inputsHash = HashBytes( &mCenter, sizeof( mCenter ), inputsHash );
+    inputsHash = HashBytes( &mSize, sizeof( mSize ), inputsHash );
+    if( inputsHash == mInputsHash && mHistoryValid ) {
+        mUnchangedFrames = std::min( mUnchangedFrames + 1, TemporalRefreshFrames );
+    }
+    else {
+        mInputsHash = inputsHash;
+        mUnchangedFrames = 0;
+    }
+
+    const bool upsample = rtv && mLowResPSO && mUpsamplePSO;
+    Uint32 width = 0, height = 0;
+    if( upsample ) {
+        const auto &targetDesc = rtv->GetTexture()->GetDesc();
+        const Uint32 scale = Uint32( std::max( mResolutionScale, 1 ) );
+        width  = std::max( ( targetDesc.Width + scale - 1 ) / scale, 1u );
+        height = std::max( ( targetDesc.Height + scale - 1 ) / scale, 1u );
+        if( ! mLowResColor[0] || mLowResColor[0]->GetDesc().Width != width || mLowResColor[0]->GetDesc().Height != height ) {
+            initLowResTargets( width, height );
+        }
+    }
+
     // update constants buffer
     {
         MapHelper<VertexConstants> CBConstants( context, mVertexConstants, MAP_WRITE, MAP_FLAG_DISCARD );
         CBConstants->center            = mCenter;
         CBConstants->size              = mSize;
+        CBConstants->frameIndex        = mFrameIndex;
+        CBConstants->padding           = 0;
+        CBConstants->targetSize        = float2( float( width ), float( height ) );
     }
 
+    mOutputCached = false;
+    if( upsample ) {
+        const auto &targetDesc = rtv->GetTexture()->GetDesc();
+
+        // the temporal cache keeps marching until its rotating refresh has covered every pixel of the unchanged view
+        mOutputCached = mHistoryValid && mUnchangedFrames >= ( mTemporalCache ? TemporalRefreshFrames : 1u );
+
+        DrawAttribs drawAttribs;
+        drawAttribs.NumVertices = 4;
+        drawAttribs.Flags       = DRAW_FLAG_VERIFY_ALL;
+
+        if( ! mOutputCached ) {
+            uploadPixelConstants( context );
+
+            const int current = mTemporalCache ? mHistoryIndex : 0;
+            if( mTemporalCache && ! mHistoryValid ) {
+                // negative distances mark the history as empty, so every pixel is marched
+                const float clearDepth[] = { -1.0f, -1.0f, 0.0f, 0.0f };
+                ITextureView* historyDepthRTV = mLowResDepth[1 - current]->GetDefaultView( TEXTURE_VIEW_RENDER_TARGET );
+                context->SetRenderTargets( 1, &historyDepthRTV, nullptr, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+                context->ClearRenderTarget( historyDepthRTV, clearDepth, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+            }
+
+            if( mConePSO && mConeDistance ) {
+                ITextureView* coneRTV = mConeDistance->GetDefaultView( TEXTURE_VIEW_RENDER_TARGET );
+                context->SetRenderTargets( 1, &coneRTV, nullptr, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+                context->SetPipelineState( mConePSO );
+                context->CommitShaderResources( mConeSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+                context->Draw( drawAttribs );
+            }
+
+            ITextureView* lowResRTVs[] = { mLowResColor[current]->GetDefaultView( TEXTURE_VIEW_RENDER_TARGET ), mLowResDepth[current]->GetDefaultView( TEXTURE_VIEW_RENDER_TARGET ) };
+            context->SetRenderTargets( _countof(lowResRTVs), lowResRTVs, nullptr, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+            context->SetPipelineState( mLowResPSO );
+            context->CommitShaderResources( mLowResSRB[current], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+            context->Draw( drawAttribs );
+
+            mOutputIndex = current;
+            mFrameIndex++;
+            if( mTemporalCache ) {
+                mHistoryIndex = 1 - current;
+            }
+            mHistoryValid = true;
+        }
+
+        {
+            MapHelper<UpsampleConstants> CBConstants( context, mUpsampleConstants, MAP_WRITE, MAP_FLAG_DISCARD );
+            CBConstants->lowResSize  = float2( float( width ), float( height ) );
+            CBConstants->lowResScale = float2( float( width ) / float( targetDesc.Width ), float( height ) / float( targetDesc.Height ) );
+        }
+
+        context->SetRenderTargets( 1, &rtv, dsv, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        context->SetPipelineState( mUpsamplePSO );
+        context->CommitShaderResources( mUpsampleSRB[mOutputIndex], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        context->Draw( drawAttribs );
+        return;
+    }
+
+    uploadPixelConstants( context );
+
     context->SetPipelineState( mPSO );
     context->CommitShaderResources( mSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
 
@@ -168,3 +522,9 @@ void Canvas::render( IDeviceContext* context, const float4x4 &mvp )
     drawAttribs.Flags       = DRAW_FLAG_VERIFY_ALL;
     context->Draw( drawAttribs );
 }
+
+void Canvas::uploadPixelConstants( IDeviceContext* context )
+{
+    MapHelper<Uint8> CBConstants( context, mPixelConstants, MAP_WRITE, MAP_FLAG_DISCARD );
+    std::copy( mPixelConstantsData.begin(), mPixelConstantsData.end(), static_cast<Uint8*>( CBConstants ) );
+}
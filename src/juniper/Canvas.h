@@ -4,6 +4,9 @@
 #include "RefCntAutoPtr.hpp"
 #include "DeviceContext.h"
 #include "Buffer.h"
+#include "Texture.h"
+
+#include <vector>
 
 namespace juniper {
 
@@ -22,22 +25,68 @@ public:
 	void				setSize( const dg::float2 &size )		{ mSize = size; }
 	const dg::float2&	getSize() const							{ return mSize; }
 
-	dg::IBuffer*	getPixelConstantsBuffer()	{ return mPixelConstants; }
+	//! Copies the pixel shader's constants, which are uploaded on the next render() that needs to run the pixel shader
+	void	setPixelConstants( const void* data, size_t size );
+
+	//! Divides the resolution the pixel shader runs at (1, 2 or 4) when render() is given targets to upsample to with canvas_upsample.psh
+	void	setResolutionScale( int scale )		{ mResolutionScale = scale; }
+	int		getResolutionScale() const			{ return mResolutionScale; }
+
+	//! Reuses last frame's color and depth where they reproject onto the current view, only re-running the pixel shader's march
+	//! where that fails and for a rotating 1 in 16 pixels. Compiles the shader with CANVAS_LOW_RES and CANVAS_TEMPORAL, the pixel
+	//! constants need to provide the previous frame's matrices (see canvasRaymarcher.psh).
+	void	setTemporalCache( bool enable );
+	bool	getTemporalCache() const			{ return mTemporalCache; }
+	//! Call when something the constants don't cover changes what the pixel shader draws, the next frame is then rendered in full
+	void	invalidateHistory()					{ mHistoryValid = false; }
+	//! Runs coneMain() of the pixel shader at 1/8 of its resolution before it, compiling the shader with CANVAS_CONE_START so it
+	//! can start sphere tracing each pixel from its tile's conservative cone distance. Only used when render() has targets.
+	void	setConePrepass( bool enable );
+	bool	getConePrepass() const				{ return mConePrepass; }
+	//! True when the last render() only reused the previous output
+	bool	isOutputCached() const				{ return mOutputCached; }
 
 	void update( double deltaSeconds );
-	void render( dg::IDeviceContext* context, const dg::float4x4 &mvp );
+	//! Draws into the bound render targets when \a rtv is null. Otherwise the pixel shader writes to the canvas' own color and depth
+	//! targets, which are upsampled to \a rtv and \a dsv. Those are kept, so as long as the constants and center / size stay the
+	//! same the pixel shader is skipped and only the upsample runs.
+	void render( dg::IDeviceContext* context, const dg::float4x4 &mvp, dg::ITextureView* rtv = nullptr, dg::ITextureView* dsv = nullptr );
 
 private:
 	void initPipelineState();
+	void initLowResTargets( dg::Uint32 width, dg::Uint32 height );
+	void uploadPixelConstants( dg::IDeviceContext* context );
 	void watchShadersDir();
 	void reloadOnAssetsUpdated();
 
 	dg::float2 mCenter = { 0, 0 };
 	dg::float2 mSize = { 1, 1 };
+	int        mResolutionScale = 1;
+	bool       mTemporalCache = false;
+	bool       mConePrepass = false;
 
 	dg::RefCntAutoPtr<dg::IPipelineState>			mPSO;
 	dg::RefCntAutoPtr<dg::IShaderResourceBinding>	mSRB;
 	dg::RefCntAutoPtr<dg::IBuffer>					mVertexConstants, mPixelConstants;
+	std::vector<dg::Uint8>							mPixelConstantsData;
+
+	// reduced resolution rendering, the second set of targets is only used as history by the temporal cache
+	dg::RefCntAutoPtr<dg::IPipelineState>			mLowResPSO, mUpsamplePSO;
+	dg::RefCntAutoPtr<dg::IShaderResourceBinding>	mLowResSRB[2], mUpsampleSRB[2];
+	dg::RefCntAutoPtr<dg::IBuffer>					mUpsampleConstants;
+	dg::RefCntAutoPtr<dg::ITexture>					mLowResColor[2], mLowResDepth[2];
+	dg::RefCntAutoPtr<dg::IPipelineState>			mConePSO;
+	dg::RefCntAutoPtr<dg::IShaderResourceBinding>	mConeSRB;
+	dg::RefCntAutoPtr<dg::ITexture>					mConeDistance;
+	int												mHistoryIndex = 0; // targets rendered into this frame, the others hold last frame
+	bool											mHistoryValid = false;
+
+	// skipping the pixel shader while its inputs are unchanged
+	size_t											mInputsHash = 0;
+	int												mOutputIndex = 0; // low res targets last rendered into
+	dg::Uint32										mUnchangedFrames = 0;
+	dg::Uint32										mFrameIndex = 0;
+	bool											mOutputCached = false;
 };
 
 } // namespace juniper
\ No newline at end of file
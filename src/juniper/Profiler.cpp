@@ -44,7 +44,11 @@ void Profiler::end( IDeviceContext *context, const std::string &label )
 	auto it = mGpuDurations.find( label );
 	assert( it != mGpuDurations.end() );
 
-	mQuerier->End( context, it->second );
+	if( mQuerier->End( context, it->second ) ) {
+		auto &stats = mGpuStats[label];
+		stats.totalSeconds += it->second;
+		stats.numSamples++;
+	}
 }
 
 //void Profiler::update( double elapsedTime )
@@ -21,6 +21,15 @@ public:
     //void update( double ElapsedTime );
     void updateUI( bool *open = nullptr );
 
+    struct Stats {
+        double  totalSeconds = 0;
+        int     numSamples = 0;
+    };
+
+    //! Gpu durations accumulated per label since the last resetStats(), for averaging over many frames
+    const std::map<std::string, Stats>&  getStats() const  { return mGpuStats; }
+    void                                 resetStats()      { mGpuStats.clear(); }
+
 private:
     // TODO: use for cpu profiling
     using TimePoint = std::chrono::high_resolution_clock::time_point;
@@ -29,6 +38,7 @@ private:
     dg::RefCntAutoPtr<dg::IRenderDevice>        mDevice;
     std::unique_ptr<dg::DurationQueryHelper>    mQuerier;
     std::map<std::string, double>               mGpuDurations;
+    std::map<std::string, Stats>                mGpuStats;
 
     //std::array<Frame, (1 << NumFramesPOT)> m_FrameHistory = {}; // TODO: keep a history and average for smoother results
 };
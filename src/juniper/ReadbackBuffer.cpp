@@ -0,0 +1,89 @@
+#include "ReadbackBuffer.h"
+
+#include <algorithm>
+
+using namespace Diligent;
+using namespace std;
+
+namespace juniper {
+
+ReadbackBuffer::ReadbackBuffer( IRenderDevice* device, const std::string &name, size_t maxSize, size_t depth, Uint64 immediateContextMask )
+	: mMaxSize( maxSize )
+{
+	VERIFY_EXPR( depth > 0 && maxSize > 0 );
+
+	mSlots.resize( depth );
+	for( size_t i = 0; i < depth; i++ ) {
+		string slotName = name + " readback " + to_string( i );
+
+		BufferDesc desc;
+		desc.Name           = slotName.c_str();
+		desc.Usage          = USAGE_STAGING;
+		desc.BindFlags      = BIND_NONE;
+		desc.Mode           = BUFFER_MODE_UNDEFINED;
+		desc.CPUAccessFlags = CPU_ACCESS_READ;
+		desc.Size           = maxSize;
+		desc.ImmediateContextMask = immediateContextMask;
+		device->CreateBuffer( desc, nullptr, &mSlots[i].staging );
+		VERIFY_EXPR( mSlots[i].staging != nullptr );
+	}
+
+	string fenceName = name + " readback fence";
+	FenceDesc fenceDesc;
+	fenceDesc.Name = fenceName.c_str();
+	device->CreateFence( fenceDesc, &mFence );
+}
+
+bool ReadbackBuffer::enqueue( IDeviceContext* context, IBuffer* source, size_t offset, size_t size )
+{
+	if( mNumPending == mSlots.size() ) {
+		return false;
+	}
+
+	size = std::min( size, mMaxSize );
+	if( size == 0 ) {
+		return false;
+	}
+
+	Slot &slot = mSlots[mWriteIndex];
+	context->CopyBuffer( source, Uint32( offset ), RESOURCE_STATE_TRANSITION_MODE_TRANSITION,
+		slot.staging, 0, Uint32( size ), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+	slot.fenceValue = mNextFenceValue++;
+	slot.sourceOffset = offset;
+	slot.size = size;
+	context->EnqueueSignal( mFence, slot.fenceValue );
+
+	mWriteIndex = ( mWriteIndex + 1 ) % mSlots.size();
+	mNumPending++;
+	return true;
+}
+
+bool ReadbackBuffer::consume( IDeviceContext* context, const ConsumeFn &fn )
+{
+	const Uint64 completedValue = mFence->GetCompletedValue();
+
+	bool consumed = false;
+	while( mNumPending > 0 ) {
+		Slot &slot = mSlots[mReadIndex];
+		if( slot.fenceValue > completedValue ) {
+			break;
+		}
+
+		// the fence has passed so this shouldn't wait
+		void *data = nullptr;
+		context->MapBuffer( slot.staging, MAP_READ, MAP_FLAG_DO_NOT_WAIT, data );
+		if( data ) {
+			fn( data, slot.size, slot.sourceOffset );
+			context->UnmapBuffer( slot.staging, MAP_READ );
+			consumed = true;
+		}
+
+		mReadIndex = ( mReadIndex + 1 ) % mSlots.size();
+		mNumPending--;
+	}
+
+	return consumed;
+}
+
+} // namespace juniper
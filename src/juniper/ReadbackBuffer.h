@@ -0,0 +1,54 @@
+#pragma once
+
+#include "RefCntAutoPtr.hpp"
+#include "RenderDevice.h"
+#include "DeviceContext.h"
+#include "Buffer.h"
+#include "Fence.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace juniper {
+
+namespace dg = Diligent;
+
+//! Ring of staging buffers for reading back gpu buffers without stalling the context.
+//! Each enqueue() copies a range of the source into the next free slot and signals a fence,
+//! consume() hands back any slots whose fence has completed (usually ~2 frames later with a depth of 3).
+class ReadbackBuffer {
+public:
+	using ConsumeFn = std::function<void( const void *data, size_t size, size_t sourceOffset )>;
+
+	//! maxSize is the largest range (in bytes) that can be read back at once.
+	//! immediateContextMask must include every immediate context that will enqueue() or consume().
+	ReadbackBuffer( dg::IRenderDevice* device, const std::string &name, size_t maxSize, size_t depth = 3, dg::Uint64 immediateContextMask = 1 );
+
+	//! Copies [offset, offset + size) of source into the next free slot. Returns false if all slots are still in flight.
+	bool enqueue( dg::IDeviceContext* context, dg::IBuffer* source, size_t offset, size_t size );
+	//! Calls fn for each completed readback, oldest first. Returns true if anything was consumed.
+	bool consume( dg::IDeviceContext* context, const ConsumeFn &fn );
+
+	size_t	getMaxSize() const		{ return mMaxSize; }
+	size_t	getDepth() const		{ return mSlots.size(); }
+	size_t	getNumPending() const	{ return mNumPending; }
+
+private:
+	struct Slot {
+		dg::RefCntAutoPtr<dg::IBuffer>	staging;
+		dg::Uint64						fenceValue = 0;
+		size_t							sourceOffset = 0;
+		size_t							size = 0;
+	};
+
+	std::vector<Slot>				mSlots;
+	dg::RefCntAutoPtr<dg::IFence>	mFence;
+	dg::Uint64						mNextFenceValue = 1; // Can't signal 0
+	size_t							mMaxSize = 0;
+	size_t							mWriteIndex = 0;
+	size_t							mReadIndex = 0;
+	size_t							mNumPending = 0;
+};
+
+} // namespace juniper
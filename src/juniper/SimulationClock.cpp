@@ -0,0 +1,38 @@
+#include "SimulationClock.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace juniper {
+
+SimulationClock::SimulationClock( double fixedStep, int maxSubsteps )
+	: mFixedStep( fixedStep ), mMaxSubsteps( maxSubsteps )
+{
+}
+
+int SimulationClock::advance( double elapsedSeconds )
+{
+	mAccumulator += std::max( elapsedSeconds, 0.0 );
+
+	int steps = int( std::floor( mAccumulator / mFixedStep ) );
+	mAccumulator -= steps * mFixedStep;
+
+	if( steps > mMaxSubsteps ) {
+		mDroppedSeconds += ( steps - mMaxSubsteps ) * mFixedStep;
+		steps = std::max( mMaxSubsteps, 0 );
+	}
+
+	mNumSubsteps = steps;
+	mSimulationTime += steps * mFixedStep;
+	return steps;
+}
+
+void SimulationClock::reset()
+{
+	mAccumulator = 0;
+	mNumSubsteps = 0;
+	mDroppedSeconds = 0;
+	mSimulationTime = 0;
+}
+
+} // namespace juniper
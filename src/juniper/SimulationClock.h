@@ -0,0 +1,41 @@
+#pragma once
+
+namespace juniper {
+
+//! Fixed timestep scheduler, decouples how often a simulation steps from the frame rate.
+//! Real time is accumulated each frame and consumed in whole steps of getFixedStep() seconds, up to getMaxSubsteps() per frame.
+//! Whatever is left over is exposed as getAlpha() for interpolating between the last two simulation states.
+class SimulationClock {
+public:
+	SimulationClock( double fixedStep = 1.0 / 60.0, int maxSubsteps = 4 );
+
+	//! Adds elapsedSeconds (already scaled by any speed multiplier) and returns how many fixed steps to run this frame.
+	//! If more than getMaxSubsteps() are due, the extra time is dropped rather than carried over so a slow frame can't snowball.
+	int		advance( double elapsedSeconds );
+	//! Clears accumulated time, ex. after the simulation is reset
+	void	reset();
+
+	void	setFixedStep( double seconds )	{ mFixedStep = seconds; }
+	double	getFixedStep() const			{ return mFixedStep; }
+	void	setMaxSubsteps( int steps )		{ mMaxSubsteps = steps; }
+	int		getMaxSubsteps() const			{ return mMaxSubsteps; }
+
+	//! Fraction of a step between the previous and current state, in [0, 1)
+	double	getAlpha() const				{ return mAccumulator / mFixedStep; }
+	//! Number of steps returned by the last advance()
+	int		getNumSubsteps() const			{ return mNumSubsteps; }
+	//! Total simulated seconds that were dropped because the substep budget was exceeded
+	double	getDroppedSeconds() const		{ return mDroppedSeconds; }
+	//! Total simulated seconds, a multiple of getFixedStep()
+	double	getSimulationTime() const		{ return mSimulationTime; }
+
+private:
+	double	mFixedStep;
+	int		mMaxSubsteps;
+	double	mAccumulator = 0;
+	int		mNumSubsteps = 0;
+	double	mDroppedSeconds = 0;
+	double	mSimulationTime = 0;
+};
+
+} // namespace juniper
@@ -1,5 +1,6 @@
 // Based on Tutorial02_Cube.cpp
 
+#include <cstring>
 #include <filesystem>
 
 #include "Solids.h"
@@ -60,12 +61,24 @@ Solid::~Solid()
 {
 }
 
-//void Cube::setShaderResourceVar( dg::SHADER_TYPE shaderType, const dg::Char* name, dg::IDeviceObject* object )
-//{
-//    if( mSRB ) {
-//        mSRB->GetVariableByName( shaderType, name )->Set( object );
-//    }
-//}
+void Solid::setShaderResourceVar( dg::SHADER_TYPE shaderType, const dg::Char* name, dg::IDeviceObject* object )
+{
+    // keep the options in sync so the var is restored when the PSO is rebuilt after a shader reload
+    for( auto &var : mOptions.shaderResourceVars ) {
+        if( ( var.desc.ShaderStages & shaderType ) != 0 && strcmp( var.desc.Name, name ) == 0 ) {
+            var.object = object;
+        }
+    }
+
+    if( mSRB ) {
+        if( auto var = mSRB->GetVariableByName( shaderType, name ) ) {
+            var->Set( object );
+        }
+        else {
+            LOG_WARNING_MESSAGE( __FUNCTION__, "|(", mOptions.name, ") Failed to set shader var with name: ", name, ", shader type: ", shaderType );
+        }
+    }
+}
 
 void Solid::initPipelineState()
 {
@@ -65,8 +65,8 @@ public:
 	Solid( const Options &options = Options() );
 	virtual ~Solid();
 
-	// this is used for the structured buffer (ParticleAttribs), which is set after the SRB is already constructed.
-	//void setShaderResourceVar( dg::SHADER_TYPE shaderType, const dg::Char* name, dg::IDeviceObject* object );
+	//! Sets a var that was passed in Options::shaderResourceVars after the SRB is constructed. Use SHADER_RESOURCE_VARIABLE_TYPE_DYNAMIC for vars that change every frame.
+	void setShaderResourceVar( dg::SHADER_TYPE shaderType, const dg::Char* name, dg::IDeviceObject* object );
 
 	virtual void update( double deltaSeconds );
 	virtual void draw( dg::IDeviceContext* context, const mat4 &viewProjectionMatrix, uint32_t numInstances = 1 );
@@ -0,0 +1,266 @@
+#include "Downsampler.h"
+#include "juniper/AppGlobal.h"
+
+#include "ShaderMacroHelper.hpp"
+
+#include <algorithm>
+
+using namespace Diligent;
+
+namespace juniper { namespace post {
+
+namespace {
+
+constexpr Uint32 TileSize = 64; // mip 0 texels per group along each axis, see downsample.csh
+constexpr Uint32 BlurTileSize = 16; // texels per blur group along each axis, BLUR_GROUP_SIZE in downsample.csh
+
+}// anon
+
+Downsampler::Downsampler()
+{
+    {
+        BufferDesc CBDesc;
+        CBDesc.Name      = "Downsampler Constants Buffer";
+        CBDesc.Size      = sizeof(mConstants);
+        CBDesc.Usage     = USAGE_DEFAULT;
+        CBDesc.BindFlags = BIND_UNIFORM_BUFFER;
+        global()->renderDevice->CreateBuffer( CBDesc, nullptr, &mConstantsBuffer );
+    }
+
+    // zero initialized, the last group resets it after each dispatch
+    {
+        const Uint32 initialCount = 0;
+        BufferData counterData{ &initialCount, sizeof(initialCount) };
+
+        BufferDesc desc;
+        desc.Name              = "Downsampler Counter Buffer";
+        desc.BindFlags         = BIND_UNORDERED_ACCESS;
+        desc.Mode              = BUFFER_MODE_RAW;
+        desc.ElementByteStride = sizeof(Uint32);
+        desc.Size              = sizeof(Uint32);
+        global()->renderDevice->CreateBuffer( desc, &counterData, &mCounterBuffer );
+    }
+}
+
+// NUM_MIPS is compiled in so that only the mips that exist are declared, which means new PSOs whenever the mip count changes
+void Downsampler::initPipelineState()
+{
+    ShaderMacroHelper macros;
+    macros.AddShaderMacro( "NUM_MIPS", int( mNumMips ) );
+    macros.Finalize();
+
+    ShaderCreateInfo shaderCI;
+    shaderCI.SourceLanguage             = SHADER_SOURCE_LANGUAGE_HLSL;
+    shaderCI.pShaderSourceStreamFactory = global()->shaderSourceFactory;
+    shaderCI.FilePath                   = "shaders/post/downsample.csh";
+    shaderCI.Macros                     = macros;
+
+    ComputePipelineStateCreateInfo PSOCreateInfo;
+    PSOCreateInfo.PSODesc.PipelineType                       = PIPELINE_TYPE_COMPUTE;
+    PSOCreateInfo.PSODesc.ResourceLayout.DefaultVariableType = SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE;
+
+    mPSO.Release();
+    mSRB.Release();
+    mBlurPSO.Release();
+    mBlurSRB.Release();
+
+    {
+        RefCntAutoPtr<IShader> computeShader;
+        shaderCI.Desc       = { "Downsample CS", SHADER_TYPE_COMPUTE, true };
+        shaderCI.EntryPoint = "main";
+        global()->renderDevice->CreateShader( shaderCI, &computeShader );
+
+        PSOCreateInfo.PSODesc.Name = "Downsample PSO";
+        PSOCreateInfo.pCS          = computeShader;
+        global()->renderDevice->CreateComputePipelineState( PSOCreateInfo, &mPSO );
+    }
+    {
+        RefCntAutoPtr<IShader> computeShader;
+        shaderCI.Desc       = { "Downsample Blur CS", SHADER_TYPE_COMPUTE, true };
+        shaderCI.EntryPoint = "blurMain";
+        global()->renderDevice->CreateShader( shaderCI, &computeShader );
+
+        PSOCreateInfo.PSODesc.Name = "Downsample Blur PSO";
+        PSOCreateInfo.pCS          = computeShader;
+        global()->renderDevice->CreateComputePipelineState( PSOCreateInfo, &mBlurPSO );
+    }
+
+    if( ! mPSO || ! mBlurPSO ) {
+        LOG_ERROR_MESSAGE( "Downsampler: null mPSO or mBlurPSO, cannot create SRBs" );
+    }
+}
+
+void Downsampler::initShaderResourceBinding()
+{
+    mSRB.Release();
+    mBlurSRB.Release();
+    if( ! mPSO || ! mBlurPSO || ! mTexture ) {
+        return;
+    }
+
+    auto setMipViews = []( IShaderResourceBinding* srb, const char* name, RefCntAutoPtr<ITextureView>* mipViews, Uint32 numViews ) {
+        if( auto var = srb->GetVariableByName( SHADER_TYPE_COMPUTE, name ) ) {
+            IDeviceObject* views[MaxMipLevels - 1] = {};
+            for( Uint32 i = 0; i < numViews; i++ ) {
+                views[i] = mipViews[i];
+            }
+            var->SetArray( views, 0, numViews );
+        }
+    };
+
+    mPSO->CreateShaderResourceBinding( &mSRB, true );
+    if( auto var = mSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "DownsamplerConstants" ) ) {
+        var->Set( mConstantsBuffer );
+    }
+    if( auto var = mSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "DownsamplerCounter" ) ) {
+        var->Set( mCounterBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+    }
+    if( auto var = mSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "SrcMip" ) ) {
+        var->Set( mSrcView );
+    }
+    setMipViews( mSRB, "ReducedMips", mScratchMipViews, mNumMips - 1 );
+
+    mBlurPSO->CreateShaderResourceBinding( &mBlurSRB, true );
+    if( auto var = mBlurSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "DownsamplerConstants" ) ) {
+        var->Set( mConstantsBuffer );
+    }
+    if( auto var = mBlurSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "ReducedChain" ) ) {
+        var->Set( mScratchSrcView );
+    }
+    setMipViews( mBlurSRB, "OutMips", mMipViews, mNumMips - 1 );
+}
+
+void Downsampler::setTexture( ITexture* texture )
+{
+    mTexture = texture;
+    mSrcView.Release();
+    for( auto &view : mMipViews ) {
+        view.Release();
+    }
+    mScratch.Release();
+    mScratchSrcView.Release();
+    for( auto &view : mScratchMipViews ) {
+        view.Release();
+    }
+
+    if( ! mTexture ) {
+        mSRB.Release();
+        mBlurSRB.Release();
+        return;
+    }
+
+    const auto &desc = mTexture->GetDesc();
+    if( ! ( desc.BindFlags & BIND_UNORDERED_ACCESS ) || desc.MipLevels < 2 || desc.MipLevels > MaxMipLevels ) {
+        LOG_ERROR_MESSAGE( "Downsampler: texture '", ( desc.Name ? desc.Name : "" ), "' needs BIND_UNORDERED_ACCESS and 2 - ", MaxMipLevels, " mip levels" );
+        mTexture.Release();
+        mSRB.Release();
+        mBlurSRB.Release();
+        return;
+    }
+    // past mip 6 a single group reduces the whole of mip 6 in groupshared memory, see downsample.csh
+    if( desc.MipLevels > 7 && ( std::max( desc.Width, desc.Height ) >> 6 ) > TileSize ) {
+        LOG_ERROR_MESSAGE( "Downsampler: texture '", ( desc.Name ? desc.Name : "" ), "' is ", desc.Width, "x", desc.Height,
+            ", more than 7 mip levels need it to be at most ", TileSize << 6, " texels on each side" );
+        mTexture.Release();
+        mSRB.Release();
+        mBlurSRB.Release();
+        return;
+    }
+
+    TextureViewDesc viewDesc;
+    viewDesc.TextureDim   = RESOURCE_DIM_TEX_2D;
+    viewDesc.NumMipLevels = 1;
+
+    viewDesc.ViewType        = TEXTURE_VIEW_SHADER_RESOURCE;
+    viewDesc.MostDetailedMip = 0;
+    mTexture->CreateView( viewDesc, &mSrcView );
+
+    viewDesc.ViewType = TEXTURE_VIEW_UNORDERED_ACCESS;
+    for( Uint32 mip = 1; mip < desc.MipLevels; mip++ ) {
+        viewDesc.MostDetailedMip = mip;
+        mTexture->CreateView( viewDesc, &mMipViews[mip - 1] );
+    }
+
+    // same chain without mip 0, the blur reads it while writing the texture
+    {
+        TextureDesc scratchDesc;
+        scratchDesc.Name      = "Downsampler Scratch";
+        scratchDesc.Type      = RESOURCE_DIM_TEX_2D;
+        scratchDesc.Width     = std::max( desc.Width >> 1, 1u );
+        scratchDesc.Height    = std::max( desc.Height >> 1, 1u );
+        scratchDesc.MipLevels = desc.MipLevels - 1;
+        scratchDesc.Format    = desc.Format;
+        scratchDesc.BindFlags = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+        global()->renderDevice->CreateTexture( scratchDesc, nullptr, &mScratch );
+
+        mScratchSrcView = mScratch->GetDefaultView( TEXTURE_VIEW_SHADER_RESOURCE );
+        for( Uint32 level = 0; level < scratchDesc.MipLevels; level++ ) {
+            viewDesc.MostDetailedMip = level;
+            mScratch->CreateView( viewDesc, &mScratchMipViews[level] );
+        }
+    }
+
+    mConstants.srcSize       = { desc.Width, desc.Height };
+    mConstants.numWorkGroups = ( ( desc.Width + TileSize - 1 ) / TileSize ) * ( ( desc.Height + TileSize - 1 ) / TileSize );
+    mConstantsDirty = true;
+
+    if( ! mPSO || ! mBlurPSO || mNumMips != desc.MipLevels ) {
+        mNumMips = desc.MipLevels;
+        initPipelineState();
+    }
+    initShaderResourceBinding();
+}
+
+void Downsampler::reloadShaders()
+{
+    LOG_INFO_MESSAGE( __FUNCTION__, "| re-initializing shader assets" );
+
+    initPipelineState();
+    initShaderResourceBinding();
+}
+
+void Downsampler::apply( IDeviceContext* context )
+{
+    if( ! mSRB || ! mBlurSRB ) {
+        return;
+    }
+
+    if( mConstantsDirty ) {
+        context->UpdateBuffer( mConstantsBuffer, 0, sizeof( mConstants ), &mConstants, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        StateTransitionDesc bufferBarriers[] = {
+            { mConstantsBuffer, RESOURCE_STATE_UNKNOWN, RESOURCE_STATE_CONSTANT_BUFFER, STATE_TRANSITION_FLAG_UPDATE_STATE },
+            { mCounterBuffer, RESOURCE_STATE_UNKNOWN, RESOURCE_STATE_UNORDERED_ACCESS, STATE_TRANSITION_FLAG_UPDATE_STATE }
+        };
+        context->TransitionResourceStates( _countof(bufferBarriers), bufferBarriers );
+        mConstantsDirty = false;
+    }
+
+    // main() reads mip 0 and writes the scratch chain, blurMain() reads the scratch chain and writes mips 1 and up. Neither
+    // reads and writes the same texture, so whole resource transitions are enough on every backend (D3D11 can't track mips).
+    context->SetRenderTargets( 0, nullptr, nullptr, RESOURCE_STATE_TRANSITION_MODE_NONE );
+
+    context->SetPipelineState( mPSO );
+    context->CommitShaderResources( mSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+    DispatchComputeAttribs dispatchAttribs;
+    dispatchAttribs.ThreadGroupCountX = ( mConstants.srcSize.x + TileSize - 1 ) / TileSize;
+    dispatchAttribs.ThreadGroupCountY = ( mConstants.srcSize.y + TileSize - 1 ) / TileSize;
+    context->DispatchCompute( dispatchAttribs );
+
+    // the scratch chain is complete, blur it into the texture's mips
+    context->SetPipelineState( mBlurPSO );
+    context->CommitShaderResources( mBlurSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+    const auto &scratchDesc = mScratch->GetDesc();
+    DispatchComputeAttribs blurDispatchAttribs;
+    blurDispatchAttribs.ThreadGroupCountX = ( scratchDesc.Width + BlurTileSize - 1 ) / BlurTileSize;
+    blurDispatchAttribs.ThreadGroupCountY = ( scratchDesc.Height + BlurTileSize - 1 ) / BlurTileSize;
+    blurDispatchAttribs.ThreadGroupCountZ = scratchDesc.MipLevels;
+    context->DispatchCompute( blurDispatchAttribs );
+
+    StateTransitionDesc barrier{ mTexture, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_SHADER_RESOURCE, 0u, REMAINING_MIP_LEVELS };
+    barrier.Flags = STATE_TRANSITION_FLAG_UPDATE_STATE;
+    context->TransitionResourceStates( 1, &barrier );
+}
+
+}} // namespace juniper::post
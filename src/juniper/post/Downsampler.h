@@ -0,0 +1,59 @@
+#pragma once
+
+#include "DeviceContext.h"
+#include "RenderDevice.h"
+#include "RefCntAutoPtr.hpp"
+#include "BasicMath.hpp"
+
+namespace juniper { namespace post {
+
+namespace dg = Diligent;
+using dg::RefCntAutoPtr;
+
+//! Generates all mips of a texture from mip 0 with a 5x5 gaussian on every level (shaders/post/downsample.csh). One dispatch
+//! reduces mip 0 into a scratch chain, a second one blurs every level of it into the texture.
+class Downsampler {
+public:
+	Downsampler();
+
+	//! Set the texture to downsample. It needs BIND_UNORDERED_ACCESS and at most 13 mip levels. With more than 7 levels it can't
+	//! be larger than 4096 on either side.
+	void setTexture( dg::ITexture* texture );
+
+	//! Writes mips 1 and up from mip 0, afterwards the whole texture is in RESOURCE_STATE_SHADER_RESOURCE
+	void apply( dg::IDeviceContext* context );
+
+	void reloadShaders();
+
+	static constexpr dg::Uint32 MaxMipLevels = 13;
+
+private:
+	void initPipelineState();
+	void initShaderResourceBinding();
+
+	RefCntAutoPtr<dg::IPipelineState>         mPSO;
+	RefCntAutoPtr<dg::IShaderResourceBinding> mSRB;
+	RefCntAutoPtr<dg::IPipelineState>         mBlurPSO;
+	RefCntAutoPtr<dg::IShaderResourceBinding> mBlurSRB;
+	RefCntAutoPtr<dg::IBuffer>                mConstantsBuffer;
+	RefCntAutoPtr<dg::IBuffer>                mCounterBuffer;
+	RefCntAutoPtr<dg::ITexture>               mTexture;
+	RefCntAutoPtr<dg::ITextureView>           mSrcView;
+	RefCntAutoPtr<dg::ITextureView>           mMipViews[MaxMipLevels - 1];
+	RefCntAutoPtr<dg::ITexture>               mScratch; // level i is the unfiltered mip i + 1
+	RefCntAutoPtr<dg::ITextureView>           mScratchSrcView;
+	RefCntAutoPtr<dg::ITextureView>           mScratchMipViews[MaxMipLevels - 1];
+	dg::Uint32                                mNumMips = 0; // PSO was compiled for this many, including mip 0
+
+	struct DownsamplerConstants {
+		dg::uint2  srcSize;
+		dg::Uint32 numWorkGroups;
+		dg::Uint32 padding = 0;
+	};
+	static_assert(sizeof(DownsamplerConstants) % 16 == 0, "must be aligned to 16 bytes");
+
+	DownsamplerConstants mConstants;
+	bool                 mConstantsDirty = false;
+};
+
+} } // namespace juniper::post
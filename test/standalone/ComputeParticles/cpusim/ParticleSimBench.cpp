@@ -0,0 +1,224 @@
+// Standalone benchmark for the CPU particle simulation, uses the same initial state and default constants as ComputeParticles.
+//
+// usage: ParticleSimBench [--particles N] [--frames N] [--threads N] [--brute-force] [--no-sdf] [--no-simd] [--validate]
+
+#include "ParticleSimCpu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace cpusim;
+
+namespace {
+
+struct BenchOptions {
+    int     numParticles = 10000;
+    int     numFrames = 100;
+    bool    validate = false;
+    ParticleSimCpu::Options simOptions;
+};
+
+// defaults from the ComputeParticles constructor
+ParticleConstants makeDefaultConstants( int numParticles, int maxGridCellsPerAxis = 128 )
+{
+    ParticleConstants c = {};
+    c.numParticles = numParticles;
+    c.deltaTime = 1.35f / 60.0f;
+    c.scale = 0.22f;
+    c.worldMin = { -10, 0.1f, -10 };
+    c.worldMax = { 10, 10, 10 };
+    c.speedMinMax = { 0.01f, 4.0f };
+
+    c.separation = 1.9f;
+    c.alignment = 0.25f;
+    c.cohesion = 0.146f;
+    c.separationDist = 0.688f;
+    c.alignmentDist = 1.692f;
+    c.cohesionDist = 1.956f;
+
+    c.sdfAvoidStrength = 100.0f;
+    c.sdfAvoidDistance = 5.0f;
+
+    // same as ComputeParticles::updateGridSize()
+    const float cellSize = std::max( { c.cohesionDist, c.alignmentDist, c.separationDist, 0.001f } );
+    auto cellsForAxis = [&]( float extent ) {
+        return std::clamp( int( std::floor( extent / cellSize ) ), 1, maxGridCellsPerAxis );
+    };
+    c.gridSize = { cellsForAxis( c.worldMax.x - c.worldMin.x ), cellsForAxis( c.worldMax.y - c.worldMin.y ), cellsForAxis( c.worldMax.z - c.worldMin.z ) };
+
+    return c;
+}
+
+struct ParticleState {
+    std::vector<float4> positions, velocities, forces;
+
+    ParticleStreams streams() const { return { positions.data(), velocities.data(), forces.data() }; }
+};
+
+// same distributions as ComputeParticles::spawnParticles(), which uses a counter-based hash instead of mt19937
+ParticleState makeInitialParticles( const ParticleConstants &c )
+{
+    const float birthPadding = 0.1f;
+    const float speedVariation = 0.1f;
+    const float scaleVariation = 0.1f;
+
+    ParticleState particles;
+    particles.positions.resize( c.numParticles );
+    particles.velocities.resize( c.numParticles );
+    particles.forces.resize( c.numParticles );
+
+    std::mt19937 gen;
+    float speed = ( c.speedMinMax.y - c.speedMinMax.x ) / 2.0f;
+
+    std::uniform_real_distribution<float> posDistrX( c.worldMin.x * ( 1.0f - birthPadding ), c.worldMax.x * ( 1.0f - birthPadding ) );
+    std::uniform_real_distribution<float> posDistrY( c.worldMin.y * ( 1.0f - birthPadding ), c.worldMax.y * ( 1.0f - birthPadding ) );
+    std::uniform_real_distribution<float> posDistrZ( c.worldMin.z * ( 1.0f - birthPadding ), c.worldMax.z * ( 1.0f - birthPadding ) );
+    std::uniform_real_distribution<float> speedDistr( - speed - speedVariation, speed + speedVariation );
+    std::uniform_real_distribution<float> sizeDistr( 1.0f - scaleVariation, 1.0f + scaleVariation );
+
+    for( int i = 0; i < c.numParticles; i++ ) {
+        float4 &pos = particles.positions[i];
+        float4 &vel = particles.velocities[i];
+        pos.x = posDistrX( gen );
+        pos.y = posDistrY( gen );
+        pos.z = posDistrZ( gen );
+        vel.y = speedDistr( gen );
+        vel.z = speedDistr( gen );
+        vel.x = speedDistr( gen );
+        pos.w = sizeDistr( gen );
+    }
+
+    return particles;
+}
+
+bool parseArgs( int argc, char *argv[], BenchOptions &options )
+{
+    for( int i = 1; i < argc; i++ ) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if( arg == "--particles" && hasValue ) {
+            options.numParticles = std::max( std::atoi( argv[++i] ), 1 );
+        }
+        else if( arg == "--frames" && hasValue ) {
+            options.numFrames = std::max( std::atoi( argv[++i] ), 1 );
+        }
+        else if( arg == "--threads" && hasValue ) {
+            options.simOptions.numThreads = size_t( std::max( std::atoi( argv[++i] ), 0 ) );
+        }
+        else if( arg == "--brute-force" ) {
+            options.simOptions.binningMode = 0;
+        }
+        else if( arg == "--no-sdf" ) {
+            options.simOptions.avoidSdf = false;
+        }
+        else if( arg == "--no-simd" ) {
+            options.simOptions.simd = false;
+        }
+        else if( arg == "--validate" ) {
+            options.validate = true;
+        }
+        else {
+            std::printf( "unknown argument: %s\n", arg.c_str() );
+            std::printf( "usage: ParticleSimBench [--particles N] [--frames N] [--threads N] [--brute-force] [--no-sdf] [--no-simd] [--validate]\n" );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// steps a copy of the state once with each variant and compares against the scalar brute-force reference
+bool validate( const ParticleStreams &state, size_t count, const ParticleConstants &constants, const ParticleSimCpu::Options &baseOptions )
+{
+    ParticleSimCpu::Options refOptions = baseOptions;
+    refOptions.binningMode = 0;
+    refOptions.simd = false;
+
+    ParticleSimCpu reference( refOptions );
+    reference.setParticles( state, count );
+    reference.step( constants );
+
+    const float tolerance = 1e-3f;
+    bool passed = true;
+    for( int binningMode : { 0, 1 } ) {
+        for( bool simd : { false, true } ) {
+            ParticleSimCpu::Options options = baseOptions;
+            options.binningMode = binningMode;
+            options.simd = simd;
+
+            ParticleSimCpu sim( options );
+            sim.setParticles( state, count );
+            sim.step( constants );
+
+            CompareResult result = compareParticles( reference.getParticles(), sim.getParticles(), count, tolerance );
+            std::printf( "validate %-12s %-6s mismatched: %zu / %zu, max pos error: %g, max vel error: %g, max accel error: %g\n",
+                         binningMode == 1 ? "uniform grid" : "brute force", simd ? "simd" : "scalar",
+                         result.numMismatched, result.numCompared, result.maxPosError, result.maxVelError, result.maxAccelError );
+
+            passed &= result.numMismatched == 0;
+        }
+    }
+
+    return passed;
+}
+
+} // anonymous namespace
+
+int main( int argc, char *argv[] )
+{
+    BenchOptions options;
+    if( ! parseArgs( argc, argv, options ) ) {
+        return 1;
+    }
+
+    const ParticleConstants constants = makeDefaultConstants( options.numParticles );
+    const ParticleState initialParticles = makeInitialParticles( constants );
+
+    ParticleSimCpu sim( options.simOptions );
+    sim.setParticles( initialParticles.streams(), size_t( options.numParticles ) );
+
+    std::printf( "particles: %d, frames: %d, threads: %zu, binning: %s, sdf: %s, simd: %s\n",
+                 options.numParticles, options.numFrames, sim.getConcurrency(),
+                 options.simOptions.binningMode == 1 ? "uniform grid" : "brute force",
+                 options.simOptions.avoidSdf ? "on" : "off",
+                 options.simOptions.simd && ParticleSimCpu::isSimdAvailable() ? "sse" : "off" );
+
+    // a few frames so the flock settles into clusters before timing
+    const int warmupFrames = std::min( 10, options.numFrames );
+    for( int i = 0; i < warmupFrames; i++ ) {
+        sim.step( constants );
+    }
+
+    ParticleSimCpu::Timings sum, best;
+    best.move = best.binning = best.interact = 1e30;
+    for( int i = 0; i < options.numFrames; i++ ) {
+        sim.step( constants );
+        const auto &t = sim.getLastTimings();
+        sum.move += t.move;
+        sum.binning += t.binning;
+        sum.interact += t.interact;
+        best.move = std::min( best.move, t.move );
+        best.binning = std::min( best.binning, t.binning );
+        best.interact = std::min( best.interact, t.interact );
+    }
+
+    const double n = double( options.numFrames );
+    std::printf( "%-10s %10s %10s\n", "stage", "avg (ms)", "min (ms)" );
+    std::printf( "%-10s %10.3f %10.3f\n", "move", sum.move / n, best.move );
+    std::printf( "%-10s %10.3f %10.3f\n", "binning", sum.binning / n, best.binning );
+    std::printf( "%-10s %10.3f %10.3f\n", "interact", sum.interact / n, best.interact );
+    std::printf( "%-10s %10.3f\n", "total", sum.total() / n );
+    std::printf( "particles / second: %.3g\n", double( options.numParticles ) * n / ( sum.total() / 1000.0 ) );
+
+    if( options.validate ) {
+        return validate( sim.getParticles(), sim.getNumParticles(), constants, options.simOptions ) ? 0 : 2;
+    }
+
+    return 0;
+}
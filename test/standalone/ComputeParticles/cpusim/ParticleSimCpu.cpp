@@ -0,0 +1,414 @@
+#include "ParticleSimCpu.h"
+#include "SdfScene.h"
+#include "VecMath.h"
+
+#include <chrono>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define CPUSIM_SSE 1
+#include <emmintrin.h>
+#else
+#define CPUSIM_SSE 0
+#endif
+
+namespace cpusim {
+
+namespace {
+
+const size_t PARTICLE_GRAIN_SIZE = 256;
+
+using Clock = std::chrono::high_resolution_clock;
+
+double elapsedMs( Clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+}
+
+struct ForceParams {
+    float separationDist, alignmentDist, cohesionDist;
+    float separation, alignment, cohesion;
+};
+
+struct NeighborStreams {
+    const float     *posX, *posY, *posZ;
+    const float     *dirX, *dirY, *dirZ;
+    const int32_t   *ids;
+};
+
+// same as interactParticles() in interact_particles.csh, for the neighbors in [begin, end)
+void accumulateForcesScalar( const NeighborStreams &n, size_t begin, size_t end, int selfId, const float3 &pos, const ForceParams &f, float3 &accel, int &numInteractions )
+{
+    for( size_t j = begin; j < end; j++ ) {
+        if( n.ids[j] == selfId ) {
+            continue;
+        }
+
+        float3 r10 = make_float3( n.posX[j] - pos.x, n.posY[j] - pos.y, n.posZ[j] - pos.z );
+        float dist = length( r10 );
+        if( dist < f.cohesionDist ) {
+            numInteractions += 1;
+            float3 d10 = r10 / dist;
+            if( dist < f.separationDist ) {
+                float F = ( f.separationDist / dist - 1.0f ) * f.separation;
+                accel -= d10 * F;
+            }
+            else if( dist < f.alignmentDist ) {
+                float F = ( f.alignmentDist / dist - 1.0f ) * f.alignment;
+                accel += make_float3( n.dirX[j], n.dirY[j], n.dirZ[j] ) * F;
+            }
+            else {
+                float F = ( f.cohesionDist / dist - 1.0f ) * f.cohesion;
+                accel += d10 * F;
+            }
+        }
+    }
+}
+
+#if CPUSIM_SSE
+float horizontalSum( __m128 v )
+{
+    __m128 shuf = _mm_shuffle_ps( v, v, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+    __m128 sums = _mm_add_ps( v, shuf );
+    shuf = _mm_movehl_ps( shuf, sums );
+    sums = _mm_add_ss( sums, shuf );
+    return _mm_cvtss_f32( sums );
+}
+
+// four neighbors at a time, the three force bands are computed for every lane and selected with masks
+void accumulateForcesSse( const NeighborStreams &n, size_t begin, size_t end, int selfId, const float3 &pos, const ForceParams &f, float3 &accel, int &numInteractions )
+{
+    const __m128 px = _mm_set1_ps( pos.x );
+    const __m128 py = _mm_set1_ps( pos.y );
+    const __m128 pz = _mm_set1_ps( pos.z );
+    const __m128 one = _mm_set1_ps( 1.0f );
+    const __m128 separationDist = _mm_set1_ps( f.separationDist );
+    const __m128 alignmentDist = _mm_set1_ps( f.alignmentDist );
+    const __m128 cohesionDist = _mm_set1_ps( f.cohesionDist );
+    const __m128 separation = _mm_set1_ps( f.separation );
+    const __m128 alignment = _mm_set1_ps( f.alignment );
+    const __m128 cohesion = _mm_set1_ps( f.cohesion );
+    const __m128i self = _mm_set1_epi32( selfId );
+
+    __m128 accX = _mm_setzero_ps();
+    __m128 accY = _mm_setzero_ps();
+    __m128 accZ = _mm_setzero_ps();
+    __m128i count = _mm_setzero_si128();
+
+    size_t j = begin;
+    for( ; j + 4 <= end; j += 4 ) {
+        __m128 rx = _mm_sub_ps( _mm_loadu_ps( n.posX + j ), px );
+        __m128 ry = _mm_sub_ps( _mm_loadu_ps( n.posY + j ), py );
+        __m128 rz = _mm_sub_ps( _mm_loadu_ps( n.posZ + j ), pz );
+        __m128 dist = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( rx, rx ), _mm_mul_ps( ry, ry ) ), _mm_mul_ps( rz, rz ) ) );
+
+        __m128 isSelf = _mm_castsi128_ps( _mm_cmpeq_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i *>( n.ids + j ) ), self ) );
+        __m128 inRange = _mm_andnot_ps( isSelf, _mm_cmplt_ps( dist, cohesionDist ) );
+        if( _mm_movemask_ps( inRange ) == 0 ) {
+            continue;
+        }
+
+        __m128 sepMask = _mm_and_ps( inRange, _mm_cmplt_ps( dist, separationDist ) );
+        __m128 alignMask = _mm_andnot_ps( sepMask, _mm_and_ps( inRange, _mm_cmplt_ps( dist, alignmentDist ) ) );
+        __m128 cohMask = _mm_andnot_ps( _mm_or_ps( sepMask, alignMask ), inRange );
+
+        // lanes outside of the masks may hold inf / nan (ex. dist == 0 for self), they are zeroed by the ands below
+        __m128 fSep = _mm_mul_ps( _mm_sub_ps( _mm_div_ps( separationDist, dist ), one ), separation );
+        __m128 fAlign = _mm_mul_ps( _mm_sub_ps( _mm_div_ps( alignmentDist, dist ), one ), alignment );
+        __m128 fCoh = _mm_mul_ps( _mm_sub_ps( _mm_div_ps( cohesionDist, dist ), one ), cohesion );
+
+        // separation pushes along -d10, cohesion pulls along d10, alignment follows the neighbor's direction
+        __m128 radial = _mm_div_ps( _mm_sub_ps( _mm_and_ps( cohMask, fCoh ), _mm_and_ps( sepMask, fSep ) ), dist );
+        radial = _mm_and_ps( _mm_or_ps( sepMask, cohMask ), radial );
+        __m128 align = _mm_and_ps( alignMask, fAlign );
+
+        accX = _mm_add_ps( accX, _mm_add_ps( _mm_mul_ps( radial, rx ), _mm_mul_ps( align, _mm_loadu_ps( n.dirX + j ) ) ) );
+        accY = _mm_add_ps( accY, _mm_add_ps( _mm_mul_ps( radial, ry ), _mm_mul_ps( align, _mm_loadu_ps( n.dirY + j ) ) ) );
+        accZ = _mm_add_ps( accZ, _mm_add_ps( _mm_mul_ps( radial, rz ), _mm_mul_ps( align, _mm_loadu_ps( n.dirZ + j ) ) ) );
+
+        // true lanes are -1
+        count = _mm_sub_epi32( count, _mm_castps_si128( inRange ) );
+    }
+
+    accel += make_float3( horizontalSum( accX ), horizontalSum( accY ), horizontalSum( accZ ) );
+
+    alignas( 16 ) int32_t counts[4];
+    _mm_store_si128( reinterpret_cast<__m128i *>( counts ), count );
+    numInteractions += counts[0] + counts[1] + counts[2] + counts[3];
+
+    accumulateForcesScalar( n, j, end, selfId, pos, f, accel, numInteractions );
+}
+#endif
+
+// same as interactScene() in interact_particles.csh
+void interactScene( const float3 &pos, const float3 &vel, const ParticleConstants &constants, float3 &accel, ParticleDebugAttribs &debug )
+{
+    SdfObjectInfo object;
+    SdfIntersectInfo intersect = sdf_intersect( pos, normalize( vel ), object, constants.worldMin, constants.worldMax );
+    debug.distToSDF = intersect.dist;
+    debug.sdfIterations = intersect.iterations;
+    debug.sdfRayLength = intersect.rayLength;
+
+    const float distToTurn = constants.sdfAvoidDistance;
+    if( intersect.dist < distToTurn ) {
+        debug.nearestSDFObject = object.id;
+        float3 N = object.normal;
+        float strength = distToTurn - std::abs( intersect.dist );
+        strength *= constants.sdfAvoidStrength;
+        accel += N * strength;
+        debug.sdfClosestNormal = N;
+        debug.sdfRepelStrength = strength;
+    }
+    else {
+        debug.nearestSDFObject = 0;
+        debug.sdfClosestNormal = make_float3( 0, -0.7f, 0 );
+        debug.sdfRepelStrength = 0;
+    }
+}
+
+} // anonymous namespace
+
+ParticleSimCpu::ParticleSimCpu()
+    : ParticleSimCpu( Options() )
+{
+}
+
+ParticleSimCpu::ParticleSimCpu( const Options &options )
+{
+    setOptions( options );
+}
+
+void ParticleSimCpu::setOptions( const Options &options )
+{
+    if( ! mThreadPool || options.numThreads != mOptions.numThreads ) {
+        mThreadPool = std::make_unique<ThreadPool>( options.numThreads );
+    }
+
+    mOptions = options;
+}
+
+bool ParticleSimCpu::isSimdAvailable()
+{
+    return CPUSIM_SSE != 0;
+}
+
+void ParticleSimCpu::setParticles( const ParticleStreams &streams, size_t count )
+{
+    mPositions.assign( streams.positions, streams.positions + count );
+    mVelocities.assign( streams.velocities, streams.velocities + count );
+    if( streams.forces ) {
+        mForces.assign( streams.forces, streams.forces + count );
+    }
+    else {
+        mForces.assign( count, float4() );
+    }
+    mDebugAttribs.assign( count, ParticleDebugAttribs() );
+}
+
+ParticleStreams ParticleSimCpu::getParticles() const
+{
+    ParticleStreams result;
+    result.positions = mPositions.data();
+    result.velocities = mVelocities.data();
+    result.forces = mForces.data();
+    return result;
+}
+
+void ParticleSimCpu::step( const ParticleConstants &constants )
+{
+    auto start = Clock::now();
+    moveParticles( constants );
+    mTimings.move = elapsedMs( start );
+
+    start = Clock::now();
+    binParticles( constants );
+    mTimings.binning = elapsedMs( start );
+
+    start = Clock::now();
+    interactParticles( constants );
+    mTimings.interact = elapsedMs( start );
+}
+
+// same as move_particles.csh, also records the grid cell of each particle
+void ParticleSimCpu::moveParticles( const ParticleConstants &constants )
+{
+    const bool useGrid = mOptions.binningMode == 1;
+    mParticleCells.resize( mPositions.size() );
+
+    mThreadPool->parallelFor( mPositions.size(), PARTICLE_GRAIN_SIZE, [&]( size_t begin, size_t end ) {
+        for( size_t i = begin; i < end; i++ ) {
+            const float4 &force = mForces[i];
+            float3 newVel = make_float3( mVelocities[i] ) + make_float3( force ) * constants.deltaTime;
+
+            float speed = length( newVel );
+            float3 dir = newVel / speed;
+            speed = clamp( speed, constants.speedMinMax.x, constants.speedMinMax.y );
+            float3 vel = dir * speed;
+
+            float3 pos = make_float3( mPositions[i] ) + vel * constants.deltaTime;
+            float temperature = force.w / 10.0f;
+
+            mPositions[i] = make_float4( pos, mPositions[i].w );
+            mVelocities[i] = make_float4( vel, temperature );
+
+            if( useGrid ) {
+                int3 loc = GetGridLocation( pos, constants.worldMin, constants.worldMax, constants.gridSize );
+                mParticleCells[i] = Grid3DTo1D( loc.x, loc.y, loc.z, constants.gridSize );
+            }
+        }
+    } );
+}
+
+// Counting sort by grid cell (the count / prefix sum / scatter passes on the GPU), then gathers the fields that
+// neighbors read into SoA streams in sorted order. Within a cell particles stay in id order, so results are deterministic.
+void ParticleSimCpu::binParticles( const ParticleConstants &constants )
+{
+    const size_t numParticles = mPositions.size();
+    mSortedIds.resize( numParticles );
+
+    if( mOptions.binningMode == 1 ) {
+        const int3 &gridSize = constants.gridSize;
+        const size_t numCells = size_t( gridSize.x ) * size_t( gridSize.y ) * size_t( gridSize.z );
+        mGridCellCounts.assign( numCells, 0 );
+        mGridCellOffsets.resize( numCells );
+
+        for( size_t i = 0; i < numParticles; i++ ) {
+            mGridCellCounts[mParticleCells[i]]++;
+        }
+
+        int offset = 0;
+        for( size_t c = 0; c < numCells; c++ ) {
+            mGridCellOffsets[c] = offset;
+            offset += mGridCellCounts[c];
+        }
+
+        // reuse counts as the write cursor for each cell, then restore them for interactParticles()
+        std::fill( mGridCellCounts.begin(), mGridCellCounts.end(), 0 );
+        for( size_t i = 0; i < numParticles; i++ ) {
+            int cell = mParticleCells[i];
+            mSortedIds[mGridCellOffsets[cell] + mGridCellCounts[cell]++] = int32_t( i );
+        }
+    }
+    else {
+        for( size_t i = 0; i < numParticles; i++ ) {
+            mSortedIds[i] = int32_t( i );
+        }
+    }
+
+    for( auto *stream : { &mSortedPosX, &mSortedPosY, &mSortedPosZ, &mSortedDirX, &mSortedDirY, &mSortedDirZ } ) {
+        stream->resize( numParticles );
+    }
+
+    mThreadPool->parallelFor( numParticles, PARTICLE_GRAIN_SIZE, [&]( size_t begin, size_t end ) {
+        for( size_t k = begin; k < end; k++ ) {
+            const float4 &pos = mPositions[mSortedIds[k]];
+            float3 dir = normalize( make_float3( mVelocities[mSortedIds[k]] ) );
+
+            mSortedPosX[k] = pos.x;
+            mSortedPosY[k] = pos.y;
+            mSortedPosZ[k] = pos.z;
+            mSortedDirX[k] = dir.x;
+            mSortedDirY[k] = dir.y;
+            mSortedDirZ[k] = dir.z;
+        }
+    } );
+}
+
+// same as interact_particles.csh
+void ParticleSimCpu::interactParticles( const ParticleConstants &constants )
+{
+    const ForceParams forceParams = {
+        constants.separationDist, constants.alignmentDist, constants.cohesionDist,
+        constants.separation, constants.alignment, constants.cohesion
+    };
+
+    const NeighborStreams neighbors = {
+        mSortedPosX.data(), mSortedPosY.data(), mSortedPosZ.data(),
+        mSortedDirX.data(), mSortedDirY.data(), mSortedDirZ.data(),
+        mSortedIds.data()
+    };
+
+    auto accumulateForces = accumulateForcesScalar;
+#if CPUSIM_SSE
+    if( mOptions.simd ) {
+        accumulateForces = accumulateForcesSse;
+    }
+#endif
+
+    const size_t numParticles = mPositions.size();
+    const int3 &gridSize = constants.gridSize;
+
+    mThreadPool->parallelFor( numParticles, PARTICLE_GRAIN_SIZE, [&]( size_t begin, size_t end ) {
+        for( size_t i = begin; i < end; i++ ) {
+            const float3 pos = make_float3( mPositions[i] );
+            const int particleId = int( i );
+
+            float3 accel;
+            int numInteractions = 0;
+            if( mOptions.binningMode == 1 ) {
+                // cells are at least cohesionDist wide, so only the 27 cells surrounding this particle can contain neighbors
+                int3 loc = GetGridLocation( pos, constants.worldMin, constants.worldMax, gridSize );
+                for( int z = std::max( loc.z - 1, 0 ); z <= std::min( loc.z + 1, gridSize.z - 1 ); ++z ) {
+                    for( int y = std::max( loc.y - 1, 0 ); y <= std::min( loc.y + 1, gridSize.y - 1 ); ++y ) {
+                        // cells adjacent in x are adjacent in the sorted order, so the three make up one contiguous range
+                        int xBegin = std::max( loc.x - 1, 0 );
+                        int xEnd = std::min( loc.x + 1, gridSize.x - 1 );
+                        int cellBegin = Grid3DTo1D( xBegin, y, z, gridSize );
+                        int cellEnd = Grid3DTo1D( xEnd, y, z, gridSize );
+                        size_t rangeBegin = size_t( mGridCellOffsets[cellBegin] );
+                        size_t rangeEnd = size_t( mGridCellOffsets[cellEnd] + mGridCellCounts[cellEnd] );
+                        accumulateForces( neighbors, rangeBegin, rangeEnd, particleId, pos, forceParams, accel, numInteractions );
+                    }
+                }
+            }
+            else {
+                accumulateForces( neighbors, 0, numParticles, particleId, pos, forceParams, accel, numInteractions );
+            }
+
+            ParticleDebugAttribs debug;
+            if( mOptions.avoidSdf ) {
+                interactScene( pos, make_float3( mVelocities[i] ), constants, accel, debug );
+            }
+
+            // integrated in moveParticles()
+            mForces[i] = make_float4( accel, float( numInteractions ) );
+            mDebugAttribs[i] = debug;
+        }
+    } );
+}
+
+CompareResult compareParticles( const ParticleStreams &a, const ParticleStreams &b, size_t count, float tolerance )
+{
+    auto maxError = []( const float4 &x, const float4 &y ) {
+        return std::max( std::abs( x.x - y.x ), std::max( std::abs( x.y - y.y ), std::abs( x.z - y.z ) ) );
+    };
+
+    CompareResult result;
+    result.numCompared = count;
+    for( size_t i = 0; i < count; i++ ) {
+        float posError = maxError( a.positions[i], b.positions[i] );
+        float velError = maxError( a.velocities[i], b.velocities[i] );
+        result.maxPosError = std::max( result.maxPosError, posError );
+        result.maxVelError = std::max( result.maxVelError, velError );
+        // accelerations can be in the hundreds near the SDF, so they are compared relative to their magnitude
+        float accelError = 0;
+        float accelTolerance = tolerance;
+        if( a.forces && b.forces ) {
+            const float4 &f = a.forces[i];
+            accelError = maxError( f, b.forces[i] );
+            accelTolerance *= std::max( { 1.0f, std::abs( f.x ), std::abs( f.y ), std::abs( f.z ) } );
+            result.maxAccelError = std::max( result.maxAccelError, accelError );
+        }
+
+        // written as a negated compare so that nans count as mismatches
+        if( ! ( posError <= tolerance && velError <= tolerance && accelError <= accelTolerance ) ) {
+            if( result.numMismatched == 0 ) {
+                result.firstMismatch = i;
+            }
+            result.numMismatched++;
+        }
+    }
+
+    return result;
+}
+
+} // namespace cpusim
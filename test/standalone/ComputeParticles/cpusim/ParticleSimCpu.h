@@ -0,0 +1,99 @@
+#pragma once
+
+#include "ParticleTypes.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace cpusim {
+
+//! Read-only view of the particle state streams, laid out the same as the GPU buffers
+struct ParticleStreams {
+    const float4    *positions = nullptr;
+    const float4    *velocities = nullptr;
+    const float4    *forces = nullptr;
+};
+
+//! CPU implementation of move_particles.csh + interact_particles.csh, used as a reference for validating the GPU
+//! kernels and as a fallback on devices without compute shaders. Particle state is read and written in the same
+//! stream layout as the GPU buffers, each step() matches one dispatch of the GPU particle update.
+class ParticleSimCpu {
+public:
+    struct Options {
+        size_t  numThreads = 0;     //! 0 uses all hardware threads
+        int     binningMode = 1;    //! matches BINNING_MODE in the shaders, 0: brute-force, 1: uniform grid, 2: same as 0 (tiling is a GPU memory optimization)
+        bool    avoidSdf = true;    //! matches PARTICLES_AVOID_SDF in interact_particles.csh
+        bool    simd = true;        //! use SSE for neighbor force accumulation when available
+    };
+
+    //! Time spent in each stage of the last step(), in milliseconds
+    struct Timings {
+        double  move = 0;
+        double  binning = 0;
+        double  interact = 0;
+
+        double  total() const   { return move + binning + interact; }
+    };
+
+    ParticleSimCpu();
+    explicit ParticleSimCpu( const Options &options );
+
+    void    setOptions( const Options &options );
+    const Options&  getOptions() const  { return mOptions; }
+
+    //! Copies count particles from the streams, forces may be null (no acceleration)
+    void    setParticles( const ParticleStreams &streams, size_t count );
+    ParticleStreams getParticles() const;
+    size_t  getNumParticles() const { return mPositions.size(); }
+
+    const std::vector<float4>&                  getPositions() const    { return mPositions; }
+    const std::vector<float4>&                  getVelocities() const   { return mVelocities; }
+    const std::vector<float4>&                  getForces() const       { return mForces; }
+    const std::vector<ParticleDebugAttribs>&    getDebugAttribs() const { return mDebugAttribs; }
+
+    //! Advances the simulation by constants.deltaTime. constants.numParticles is ignored in favor of the count passed to setParticles()
+    void    step( const ParticleConstants &constants );
+
+    const Timings&  getLastTimings() const  { return mTimings; }
+    size_t          getConcurrency() const  { return mThreadPool->getConcurrency(); }
+
+    //! Returns true if this build has an SSE path for the neighbor force accumulation
+    static bool isSimdAvailable();
+
+private:
+    void    moveParticles( const ParticleConstants &constants );
+    void    binParticles( const ParticleConstants &constants );
+    void    interactParticles( const ParticleConstants &constants );
+
+    Options                         mOptions;
+    std::unique_ptr<ThreadPool>     mThreadPool;
+    std::vector<float4>             mPositions, mVelocities, mForces;
+    std::vector<ParticleDebugAttribs> mDebugAttribs;
+    Timings                         mTimings;
+
+    // uniform grid, sorted by cell with a counting sort as in the GPU kernels
+    std::vector<int>                mParticleCells;
+    std::vector<int>                mGridCellCounts;
+    std::vector<int>                mGridCellOffsets;
+    std::vector<int32_t>            mSortedIds;
+
+    // position and normalized velocity of each particle in sorted order (SoA), so neighbors in a cell can be loaded contiguously
+    std::vector<float>              mSortedPosX, mSortedPosY, mSortedPosZ;
+    std::vector<float>              mSortedDirX, mSortedDirY, mSortedDirZ;
+};
+
+struct CompareResult {
+    size_t  numCompared = 0;
+    size_t  numMismatched = 0;  //! particles whose position, velocity or acceleration (relative) differs by more than the tolerance
+    size_t  firstMismatch = 0;
+    float   maxPosError = 0;
+    float   maxVelError = 0;
+    float   maxAccelError = 0;
+};
+
+//! Compares positions, velocities and accelerations of two particle states, for validating the GPU simulation against ParticleSimCpu
+CompareResult compareParticles( const ParticleStreams &a, const ParticleStreams &b, size_t count, float tolerance );
+
+} // namespace cpusim
@@ -0,0 +1,56 @@
+#pragma once
+
+// CPU mirrors of the structs in assets/shaders/particles/structures.fxh. These need to stay byte-for-byte compatible
+// with the HLSL side (and the copies in ComputeParticles), so that buffers can be copied between the CPU and GPU simulations.
+
+namespace cpusim {
+
+struct float2 { float x = 0, y = 0; };
+struct float3 { float x = 0, y = 0, z = 0; };
+struct float4 { float x = 0, y = 0, z = 0, w = 0; };
+struct int2 { int x = 0, y = 0; };
+struct int3 { int x = 0, y = 0, z = 0; };
+
+// Particle state is split into float4 streams (see structures.fxh):
+// - positions:     xyz: position, w: size
+// - velocities:    xyz: velocity, w: temperature
+// - forces:        xyz: acceleration from the last interaction step, w: number of interactions
+
+struct ParticleDebugAttribs {
+    float   distToSDF = 10e6; // far away
+    float   sdfRayLength = -1;
+    int     sdfIterations = -1;
+    int     nearestSDFObject = -1;
+
+    float3  sdfClosestNormal;
+    float   sdfRepelStrength = 0;
+};
+static_assert( sizeof(ParticleDebugAttribs) == 32, "must match ParticleDebugAttribs in structures.fxh" );
+
+struct ParticleConstants {
+    int     numParticles = 0;
+    float   deltaTime = 0;
+    float   separation = 0;
+    float   scale = 0;
+
+    int3    gridSize;
+    float   farFieldDist = 0;
+
+    float2  speedMinMax;
+    float   alignment = 0;
+    float   cohesion = 0;
+
+    float   separationDist = 0;
+    float   alignmentDist = 0;
+    float   cohesionDist = 0;
+    float   sdfAvoidStrength = 0;
+
+    float3  worldMin;
+    float   sdfAvoidDistance = 0;
+
+    float3  worldMax;
+    float   padding = 0;
+};
+static_assert( sizeof(ParticleConstants) == 96, "must match ParticleConstants in structures.fxh" );
+
+} // namespace cpusim
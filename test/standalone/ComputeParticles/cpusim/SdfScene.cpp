@@ -0,0 +1,146 @@
+#include "SdfScene.h"
+#include "VecMath.h"
+
+namespace cpusim {
+
+namespace {
+
+const int   SDF_MAX_ITERATIONS  = 200;
+const float SDF_MIN_DIST        = 0.01f;
+const float SDF_MAX_DIST        = 100.0f;
+
+const int oid_nothing   = -1;
+const int oid_floor     = 1;
+const int oid_ball      = 2;
+const int oid_bbox      = 4;
+
+struct SminResult { float x, y; };
+
+float sdSphere( const float3 &p, float s )
+{
+    return length( p ) - s;
+}
+
+float sdBox( const float3 &p, const float3 &b )
+{
+    float3 q = abs( p ) - b;
+    return length( max( q, 0.0f ) ) + std::min( std::max( q.x, std::max( q.y, q.z ) ), 0.0f );
+}
+
+float sdPlane( const float3 &p, const float3 &n, float h )
+{
+    return dot( p, n ) + h;
+}
+
+float sdCone( const float3 &p, float cx, float cy, float h )
+{
+    float qx = h * ( cx / cy );
+    float qy = -h;
+
+    float wx = std::sqrt( p.x * p.x + p.z * p.z );
+    float wy = p.y;
+    float t = clamp( ( wx * qx + wy * qy ) / ( qx * qx + qy * qy ), 0.0f, 1.0f );
+    float ax = wx - qx * t;
+    float ay = wy - qy * t;
+    float bx = wx - qx * clamp( wx / qx, 0.0f, 1.0f );
+    float by = wy - qy;
+    float k = sign( qy );
+    float d = std::min( ax * ax + ay * ay, bx * bx + by * by );
+    float s = std::max( k * ( wx * qy - wy * qx ), k * ( wy - qy ) );
+    return std::sqrt( d ) * sign( s );
+}
+
+// x: smooth min, y: blending factor
+SminResult smin( float a, float b, float k )
+{
+    float h = std::max( k - std::abs( a - b ), 0.0f ) / k;
+    float m = h * h * 0.5f;
+    float s = m * k * ( 1.0f / 2.0f );
+    return ( a < b ) ? SminResult{ a - s, m } : SminResult{ b - s, 1.0f - m };
+}
+
+} // anonymous namespace
+
+float sdf_scene( const float3 &p, SdfObjectInfo &object, const float3 &worldMin, const float3 &worldMax )
+{
+    // ground plane, normal pointing up
+    float result = sdPlane( p, make_float3( 0, 1, 0 ), 0 );
+    object.id = oid_floor;
+
+    float ball = sdSphere( p - make_float3( 0, -3.0f, 0 ), 7.1f );
+    SminResult s = smin( result, ball, 3.5f );
+    result = s.x;
+    object.id = oid_ball;
+    object.materialPart = s.y;
+
+    // three cones to make crude shape of a volcano
+    float cone = sdCone( p - make_float3( 1.9f, 7.5f, -0.5f ), 2.5f, 6, 7.5f );
+    result = smin( result, cone, 2.0f ).x;
+
+    cone = sdCone( p - make_float3( -1.5f, 6.7f, -0.5f ), 3.7f, 6, 7.5f );
+    result = smin( result, cone, 1.0f ).x;
+
+    cone = sdCone( p - make_float3( 0.4f, 8.9f, 0.5f ), 2.5f, 6, 8.5f );
+    result = smin( result, cone, 1.1f ).x;
+
+    // inverted box acts as a bounding box for physics
+    float3 boundsCenter = 0.5f * ( worldMin + worldMax );
+    float3 boundsSize = 0.5f * ( worldMax - worldMin );
+    float bbox = -sdBox( p - boundsCenter, boundsSize );
+    if( bbox < result ) {
+        result = bbox;
+        object.id = oid_bbox;
+    }
+
+    return result;
+}
+
+float3 sdf_calcNormal( SdfObjectInfo &object, const float3 &worldMin, const float3 &worldMax )
+{
+    const float3 pos = object.pos;
+    const float eps = 0.002f;
+
+    const float3 v1 = make_float3(  1.0f, -1.0f, -1.0f );
+    const float3 v2 = make_float3( -1.0f, -1.0f,  1.0f );
+    const float3 v3 = make_float3( -1.0f,  1.0f, -1.0f );
+    const float3 v4 = make_float3(  1.0f,  1.0f,  1.0f );
+
+    float3 N = v1 * sdf_scene( pos + v1 * eps, object, worldMin, worldMax )
+             + v2 * sdf_scene( pos + v2 * eps, object, worldMin, worldMax )
+             + v3 * sdf_scene( pos + v3 * eps, object, worldMin, worldMax )
+             + v4 * sdf_scene( pos + v4 * eps, object, worldMin, worldMax );
+
+    return normalize( N );
+}
+
+SdfIntersectInfo sdf_intersect( const float3 &rayOrigin, const float3 &rayDir, SdfObjectInfo &object, const float3 &worldMin, const float3 &worldMax )
+{
+    float scene = SDF_MIN_DIST * 2.0f;
+    float t = 0.0f;
+    float dist = -1.0f;
+    int i;
+    for( i = 0; i < SDF_MAX_ITERATIONS; i++ ) {
+        if( scene < SDF_MIN_DIST || t > SDF_MAX_DIST )
+            break;
+
+        object.pos = rayOrigin + rayDir * t;
+        scene = sdf_scene( object.pos, object, worldMin, worldMax );
+        t += scene;
+    }
+
+    if( t < SDF_MAX_DIST ) {
+        dist = t;
+        object.normal = sdf_calcNormal( object, worldMin, worldMax );
+    }
+    else {
+        object.id = oid_nothing;
+    }
+
+    SdfIntersectInfo result;
+    result.dist = dist;
+    result.rayLength = t;
+    result.iterations = i;
+    return result;
+}
+
+} // namespace cpusim
@@ -0,0 +1,26 @@
+#pragma once
+
+// CPU port of the parts of assets/shaders/canvas/sdfScene.fxh that the particles use, compiled as with PHYSICS_SIM = 1
+
+#include "ParticleTypes.h"
+
+namespace cpusim {
+
+struct SdfObjectInfo {
+    int     id = -1;
+    float   materialPart = 0;
+    float3  pos;
+    float3  normal = { 0, 1, 0 };
+};
+
+struct SdfIntersectInfo {
+    float   dist = -1;
+    float   rayLength = 0;
+    int     iterations = 0;
+};
+
+float               sdf_scene( const float3 &p, SdfObjectInfo &object, const float3 &worldMin, const float3 &worldMax );
+float3              sdf_calcNormal( SdfObjectInfo &object, const float3 &worldMin, const float3 &worldMax );
+SdfIntersectInfo    sdf_intersect( const float3 &rayOrigin, const float3 &rayDir, SdfObjectInfo &object, const float3 &worldMin, const float3 &worldMax );
+
+} // namespace cpusim
@@ -0,0 +1,103 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace cpusim {
+
+ThreadPool::ThreadPool( size_t concurrency )
+{
+    if( concurrency == 0 ) {
+        concurrency = std::max<size_t>( std::thread::hardware_concurrency(), 1 );
+    }
+
+    // the calling thread makes up the last one
+    const size_t numWorkers = concurrency - 1;
+    mWorkers.reserve( numWorkers );
+    for( size_t i = 0; i < numWorkers; i++ ) {
+        mWorkers.emplace_back( &ThreadPool::workerLoop, this );
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mStopping = true;
+    }
+    mWorkCondition.notify_all();
+
+    for( auto &worker : mWorkers ) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor( size_t count, size_t grainSize, const std::function<void( size_t, size_t )> &fn )
+{
+    if( count == 0 ) {
+        return;
+    }
+
+    grainSize = std::max<size_t>( grainSize, 1 );
+    if( mWorkers.empty() || count <= grainSize ) {
+        fn( 0, count );
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( mMutex );
+        mJobFn = &fn;
+        mJobCount = count;
+        mJobGrainSize = grainSize;
+        mJobNextIndex = 0;
+        mNumActiveWorkers = mWorkers.size();
+        mJobGeneration++;
+    }
+    mWorkCondition.notify_all();
+
+    runChunks();
+
+    // wait for the workers to finish their last chunks before the job (and fn) go out of scope
+    std::unique_lock<std::mutex> lock( mMutex );
+    mDoneCondition.wait( lock, [this] { return mNumActiveWorkers == 0; } );
+    mJobFn = nullptr;
+}
+
+void ThreadPool::workerLoop()
+{
+    uint64_t lastGeneration = 0;
+    while( true ) {
+        {
+            std::unique_lock<std::mutex> lock( mMutex );
+            mWorkCondition.wait( lock, [this, lastGeneration] { return mStopping || mJobGeneration != lastGeneration; } );
+            if( mStopping ) {
+                return;
+            }
+            lastGeneration = mJobGeneration;
+        }
+
+        runChunks();
+
+        bool lastWorker;
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            lastWorker = --mNumActiveWorkers == 0;
+        }
+        if( lastWorker ) {
+            mDoneCondition.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runChunks()
+{
+    while( true ) {
+        size_t begin = mJobNextIndex.fetch_add( mJobGrainSize );
+        if( begin >= mJobCount ) {
+            break;
+        }
+
+        (*mJobFn)( begin, std::min( begin + mJobGrainSize, mJobCount ) );
+    }
+}
+
+} // namespace cpusim
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cpusim {
+
+//! Fixed-size pool of worker threads, used to split simulation kernels across cores. The calling thread also takes part
+//! in parallelFor(), so a pool with N threads keeps N + 1 cores busy.
+class ThreadPool {
+public:
+    //! concurrency is the total number of threads including the caller, 0 uses std::thread::hardware_concurrency()
+    explicit ThreadPool( size_t concurrency = 0 );
+    ~ThreadPool();
+
+    ThreadPool( const ThreadPool & ) = delete;
+    ThreadPool& operator=( const ThreadPool & ) = delete;
+
+    //! Number of threads that take part in parallelFor(), including the calling thread
+    size_t  getConcurrency() const  { return mWorkers.size() + 1; }
+
+    //! Calls fn( begin, end ) for consecutive ranges of at most grainSize covering [0, count), blocks until all have finished
+    void    parallelFor( size_t count, size_t grainSize, const std::function<void( size_t, size_t )> &fn );
+
+private:
+    void    workerLoop();
+    void    runChunks();
+
+    std::vector<std::thread>    mWorkers;
+    std::mutex                  mMutex;
+    std::condition_variable     mWorkCondition, mDoneCondition;
+    bool                        mStopping = false;
+    uint64_t                    mJobGeneration = 0;
+    size_t                      mNumActiveWorkers = 0;
+
+    // current job, only valid while parallelFor() is running
+    const std::function<void( size_t, size_t )> *mJobFn = nullptr;
+    size_t                      mJobCount = 0;
+    size_t                      mJobGrainSize = 1;
+    std::atomic<size_t>         mJobNextIndex = { 0 };
+};
+
+} // namespace cpusim
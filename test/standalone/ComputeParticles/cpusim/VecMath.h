@@ -0,0 +1,56 @@
+#pragma once
+
+// Small subset of HLSL vector math needed to port the particle shaders
+
+#include "ParticleTypes.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cpusim {
+
+inline float3 make_float3( float x, float y, float z )  { float3 r; r.x = x; r.y = y; r.z = z; return r; }
+inline float3 make_float3( float v )                    { return make_float3( v, v, v ); }
+inline float3 make_float3( const float4 &v )            { return make_float3( v.x, v.y, v.z ); }
+inline float4 make_float4( const float3 &v, float w )   { float4 r; r.x = v.x; r.y = v.y; r.z = v.z; r.w = w; return r; }
+
+inline float3 operator+( const float3 &a, const float3 &b )   { return make_float3( a.x + b.x, a.y + b.y, a.z + b.z ); }
+inline float3 operator-( const float3 &a, const float3 &b )   { return make_float3( a.x - b.x, a.y - b.y, a.z - b.z ); }
+inline float3 operator*( const float3 &a, const float3 &b )   { return make_float3( a.x * b.x, a.y * b.y, a.z * b.z ); }
+inline float3 operator/( const float3 &a, const float3 &b )   { return make_float3( a.x / b.x, a.y / b.y, a.z / b.z ); }
+inline float3 operator*( const float3 &a, float s )           { return make_float3( a.x * s, a.y * s, a.z * s ); }
+inline float3 operator*( float s, const float3 &a )           { return a * s; }
+inline float3 operator/( const float3 &a, float s )           { return make_float3( a.x / s, a.y / s, a.z / s ); }
+inline float3 operator-( const float3 &a )                    { return make_float3( -a.x, -a.y, -a.z ); }
+inline float3& operator+=( float3 &a, const float3 &b )       { a = a + b; return a; }
+inline float3& operator-=( float3 &a, const float3 &b )       { a = a - b; return a; }
+
+inline float  dot( const float3 &a, const float3 &b )         { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float  length( const float3 &a )                       { return std::sqrt( dot( a, a ) ); }
+inline float3 normalize( const float3 &a )                    { return a / length( a ); }
+inline float3 abs( const float3 &a )                          { return make_float3( std::abs( a.x ), std::abs( a.y ), std::abs( a.z ) ); }
+inline float3 max( const float3 &a, float b )                 { return make_float3( std::max( a.x, b ), std::max( a.y, b ), std::max( a.z, b ) ); }
+
+inline float  clamp( float v, float lo, float hi )            { return std::min( std::max( v, lo ), hi ); }
+inline int    clamp( int v, int lo, int hi )                  { return std::min( std::max( v, lo ), hi ); }
+inline float  sign( float v )                                 { return v > 0.0f ? 1.0f : ( v < 0.0f ? -1.0f : 0.0f ); }
+
+// matches Grid3DTo1D() in particles.fxh
+inline int Grid3DTo1D( int x, int y, int z, const int3 &gridSize )
+{
+    return x + y * gridSize.x + z * gridSize.x * gridSize.y;
+}
+
+// matches GetGridLocation() in particles.fxh
+inline int3 GetGridLocation( const float3 &pos, const float3 &worldMin, const float3 &worldMax, const int3 &gridSize )
+{
+    float3 normalizedPos = ( pos - worldMin ) / ( worldMax - worldMin );
+
+    int3 loc;
+    loc.x = clamp( int( std::floor( normalizedPos.x * float( gridSize.x ) ) ), 0, gridSize.x - 1 );
+    loc.y = clamp( int( std::floor( normalizedPos.y * float( gridSize.y ) ) ), 0, gridSize.y - 1 );
+    loc.z = clamp( int( std::floor( normalizedPos.z * float( gridSize.z ) ) ), 0, gridSize.z - 1 );
+    return loc;
+}
+
+} // namespace cpusim
@@ -5,10 +5,12 @@
 #include "ComputeParticles.hpp"
 #include "BasicMath.hpp"
 #include "MapHelper.hpp"
+#include "AdvancedMath.hpp"
 #include "imgui.h"
 #include "imgui_internal.h" // ShortCut()
 #include "imGuIZMO.h"
 #include "ShaderMacroHelper.hpp"
+#include "GraphicsAccessories.hpp"
 
 #include "juniper/AppGlobal.h"
 #include "juniper/FileWatch.h"
@@ -19,8 +21,14 @@
 #define LPP_PATH "../../../../../tools/LivePP"
 #endif
 
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
-#include <random>
+#include <limits>
+#include <numeric>
+#include <sstream>
 
 using namespace Diligent;
 using namespace ju;
@@ -33,31 +41,172 @@ Diligent::SampleBase* Diligent::CreateSample()
 
 namespace {
 
-struct ParticleAttribs {
-    float3 pos;
-    float  padding0;
-    float3 newPos;
-    float  distToSDF = 10e6; // far away
-
-    float3 vel;
-    float  padding2;
-    float3 newVel;
-    float  padding3;
-
-    float3  accel;
+// matches structures.fxh, particle positions, velocities and forces are float4 streams
+struct ParticleDebugAttribs {
+    float   distToSDF = 10e6; // far away
     float   sdfRayLength = -1;
-    float3  newAccel;
     int     sdfIterations = -1;
+    int     nearestSDFObject = -1; // nothing. see sdfScene.fxh for others (oid_*)
+
+    float3  sdfClosestNormal = { 1, 2, 3 };
+    float   sdfRepelStrength = 0;
+};
+static_assert( sizeof(ParticleDebugAttribs) == sizeof(cpusim::ParticleDebugAttribs), "CPU simulation must use the same layout as the GPU buffer" );
+static_assert( sizeof(float4) == sizeof(cpusim::float4), "CPU simulation must use the same layout as the GPU buffer" );
+
+// upper bound on the particle range read back for the debug windows, sizes the readback staging buffers
+constexpr int MaxDebugParticles = 4096;
+
+// the brute force binning modes are skipped above this particle count when benchmarking
+constexpr int BenchmarkMaxBruteForceParticles = 100000;
+
+// per dimension limit on thread groups in D3D11, D3D12 and Vulkan. The per-particle kernels dispatch along x only.
+constexpr Uint32 MaxDispatchGroups = 65535;
+
+bool FitsDispatchLimit( int numThreads, int groupSize )
+{
+    return Uint64( numThreads + groupSize - 1 ) / Uint64( groupSize ) <= MaxDispatchGroups;
+}
+
+// Brackets one kernel's dispatches with a duration query while tuneThreadGroupSizes() times that kernel, does nothing otherwise
+struct ScopedKernelQuery {
+    ScopedKernelQuery( IDeviceContext* context, IQuery* query )
+        : mContext( context ), mQuery( query )
+    {
+        if( mQuery ) {
+            mContext->BeginQuery( mQuery );
+        }
+    }
+    ~ScopedKernelQuery()
+    {
+        if( mQuery ) {
+            mContext->EndQuery( mQuery );
+        }
+    }
 
-    float size              = 0;
-    float temperature       = 0;
-    int   numInteractions   = 0;
-    int   nearestSDFObject  = -1; // nothing. see sdfScene.fxh for others (oid_*)
+private:
+    IDeviceContext* mContext;
+    IQuery*         mQuery;
+};
 
-    float3 sdfClosestNormal = { 1, 2, 3 };
-    float  sdfRepelStrength;
+// tuneThreadGroupSizes() times each candidate over a few steps of at least this many particles, and at most as many as the
+// smallest candidate can dispatch
+constexpr int ThreadGroupSizeCandidates[] = { 64, 128, 256, 512 }; // ascending
+constexpr int ThreadGroupTuningParticles = 100000;
+constexpr int ThreadGroupTuningMaxParticles = int( MaxDispatchGroups ) * ThreadGroupSizeCandidates[0];
+constexpr int ThreadGroupTuningWarmupSteps = 2;
+constexpr int ThreadGroupTuningSteps = 10;
+// one line per device: the tuned sizes followed by the device key, written next to imgui.ini
+const char *ThreadGroupSizesCachePath = "thread_group_sizes.txt";
+
+// matches radix_sort.fxh
+struct RadixSortConstants {
+    int     numKeys;
+    int     numBlocks;
+    int     bitShift;
+    int     padding = 0;
+};
+constexpr int RadixSortBits = 4;
+constexpr int RadixSortBins = 1 << RadixSortBits;
+
+// matches structures.fxh
+struct VerletConstants {
+    float   skin;
+    int     forceRebuild;
+    float2  padding;
+};
+static_assert( sizeof(VerletConstants) % 16 == 0, "must be aligned to 16 bytes" );
+// the neighbor lists of binning mode 3 grow whenever a build finds more neighbors than fit (see build_verlet_lists.csh),
+// up to this many. Past that only the nearest ones are kept.
+constexpr int VerletNeighborsLimit = 256;
+// { max displacement, num rebuilds, num steps, last max displacement, overflowing neighbor count, padding }, see verlet_check.csh
+constexpr Uint32 VerletStateSize = sizeof(Uint32) * 8;
+// three sets of DispatchComputeIndirect args: prefix sum cells, scatter particles, build verlet lists
+constexpr Uint32 VerletDispatchArgsStride = sizeof(Uint32) * 3;
+
+// matches structures.fxh
+struct ParticleInitConstants {
+    float3  birthMin;
+    float   speedRange;
+    float3  birthMax;
+    float   sizeVariation;
+    Uint32  seed = 0;
+    int     firstParticle = 0;
+    int     numParticles = 0;
+    int     padding = 0;
+};
+static_assert( sizeof(ParticleInitConstants) % 16 == 0, "must be aligned to 16 bytes" );
+
+// matches structures.fxh
+struct FrustumCullConstants {
+    float4  frustumPlanes[6];
+    float   radiusScale;
+    int     enabled;
+    int     writeTransforms;
+    float   padding;
+};
+static_assert( sizeof(FrustumCullConstants) % 16 == 0, "must be aligned to 16 bytes" );
+// matches ParticleTransform in structures.fxh, a 3x4 matrix
+constexpr Uint32 ParticleTransformSize = sizeof(float4) * 3;
+// conservative bounding sphere for the sprite quad and the (non-uniformly scaled) solids, relative to particle size * scale
+constexpr float CullRadiusScale = 1.5f;
+// { NumIndices or NumVertices, NumInstances, ... } - room for DrawIndexedIndirect args, Draw only reads the first 4
+constexpr Uint32 NumDrawArgs = 5;
+
+// requested in ModifyEngineInitInfo(), the engine reads these when it creates the device so they must outlive that call
+std::vector<ImmediateContextCreateInfo> ImmediateContextCIs;
+
+// CPU copy of the particle state streams
+struct ParticleStateData {
+    std::vector<float4> positions, velocities, forces;
+
+    cpusim::ParticleStreams cpuSimStreams() const
+    {
+        cpusim::ParticleStreams result;
+        result.positions = reinterpret_cast<const cpusim::float4 *>( positions.data() );
+        result.velocities = reinterpret_cast<const cpusim::float4 *>( velocities.data() );
+        result.forces = reinterpret_cast<const cpusim::float4 *>( forces.data() );
+        return result;
+    }
 };
 
+// matches PcgHash() in particles.fxh
+Uint32 PcgHash( Uint32 v )
+{
+    Uint32 state = v * 747796405u + 2891336453u;
+    Uint32 word = ( ( state >> ( ( state >> 28u ) + 4u ) ) ^ state ) * 277803737u;
+    return ( word >> 22u ) ^ word;
+}
+
+float RandomFloat( Uint32 &state )
+{
+    state = PcgHash( state );
+    return float( state >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+// same distributions and random sequence as init_particles.csh, used when the CPU simulation owns the particle state
+void InitParticlesCpu( const ParticleInitConstants &c, ParticleStateData &result )
+{
+    result.positions.resize( c.numParticles );
+    result.velocities.resize( c.numParticles );
+    result.forces.assign( c.numParticles, float4( 0, 0, 0, 0 ) );
+
+    const Uint32 seedHash = PcgHash( c.seed );
+    for( int i = 0; i < c.numParticles; i++ ) {
+        Uint32 rng = PcgHash( Uint32( c.firstParticle + i ) + seedHash );
+        float4 &pos = result.positions[i];
+        float4 &vel = result.velocities[i];
+        pos.x = lerp( c.birthMin.x, c.birthMax.x, RandomFloat( rng ) );
+        pos.y = lerp( c.birthMin.y, c.birthMax.y, RandomFloat( rng ) );
+        pos.z = lerp( c.birthMin.z, c.birthMax.z, RandomFloat( rng ) );
+        vel.x = ( RandomFloat( rng ) * 2.0f - 1.0f ) * c.speedRange;
+        vel.y = ( RandomFloat( rng ) * 2.0f - 1.0f ) * c.speedRange;
+        vel.z = ( RandomFloat( rng ) * 2.0f - 1.0f ) * c.speedRange;
+        vel.w = 0; // temperature
+        pos.w = 1.0f + ( RandomFloat( rng ) * 2.0f - 1.0f ) * c.sizeVariation;
+    }
+}
+
 struct BackgroundPixelConstants {
     float4x4 viewProj;
     float4x4 inverseViewProj;
@@ -84,7 +233,14 @@ struct BackgroundPixelConstants {
 
     float3  worldMax;
     float   padding7;
+
+    float4x4 prevViewProj;
+    float4x4 prevInverseViewProj;
+
+    float3  prevCamPos;
+    Uint32  showIterations; // heatmap of the sphere tracing iterations instead of shading
 };
+static_assert(sizeof(BackgroundPixelConstants) % 16 == 0, "must be aligned to 16 bytes");
 
 
 bool UseFirstPersonCamera = true;
@@ -102,15 +258,120 @@ float2 CameraSpeedUp = { 0.2f, 2.0f }; // speed multipliers when {shift, ctrl} i
 
 dg::float3      LightDir  = normalize( float3( 1, -0.5f, -0.1f ) );
 
-ju::FileWatchHandle     ShadersDirWatchHandle, ShadersDirWatchHandle2;
+ju::FileWatchHandle     ShadersDirWatchHandle, ShadersDirWatchHandle2, ShadersDirWatchHandle3;
 bool                    ParticleShaderAssetsMarkedDirty = false;
 bool                    PostShaderAssetsMarkedDirty = false;
 
-std::vector<ParticleAttribs> DebugParticleAttribsData;
-std::vector<int> DebugParticleListsData;
-std::vector<int> DebugParticleListsHeadData;
+ParticleStateData DebugParticleStateData;
+std::vector<ParticleDebugAttribs> DebugParticleAttribsData;
+std::vector<int2> DebugParticleCellsData;
+std::vector<int> DebugSortedParticleIdsData;
+int DebugParticleAttribsStart = 0; // particle index of the first element in the Debug*Data vectors
+int DebugParticleGridStart = 0;
 static bool DebugShowParticleAttribsWindow = true;
-static bool DebugShowParticleListssWindow = true;
+static bool DebugShowParticleGridWindow = true;
+
+float CpuValidationTolerance = 0.001f;
+
+// Copies a GPU buffer into result through a temporary staging buffer. This stalls until the GPU is idle, so it is only
+// meant for one-off reads (switching simulation backends, validation)
+template <typename T>
+void ReadBufferBlocking( IRenderDevice *device, IDeviceContext *context, IBuffer *buffer, size_t count, std::vector<T> &result )
+{
+    BufferDesc stagingDesc;
+    stagingDesc.Name           = "Blocking readback staging buffer";
+    stagingDesc.Usage          = USAGE_STAGING;
+    stagingDesc.BindFlags      = BIND_NONE;
+    stagingDesc.CPUAccessFlags = CPU_ACCESS_READ;
+    stagingDesc.Size           = sizeof(T) * count;
+
+    RefCntAutoPtr<IBuffer> staging;
+    device->CreateBuffer( stagingDesc, nullptr, &staging );
+
+    context->CopyBuffer( buffer, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION, staging, 0, stagingDesc.Size, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    context->WaitForIdle();
+
+    result.resize( count );
+    MapHelper<T> stagingData( context, staging, MAP_READ, MAP_FLAG_NONE );
+    if( stagingData ) {
+        std::memcpy( result.data(), &stagingData[0], stagingDesc.Size );
+    }
+}
+
+void ReadParticleStateBlocking( IRenderDevice *device, IDeviceContext *context, IBuffer *positions, IBuffer *velocities, IBuffer *forces, size_t count, ParticleStateData &result )
+{
+    ReadBufferBlocking( device, context, positions, count, result.positions );
+    ReadBufferBlocking( device, context, velocities, count, result.velocities );
+    ReadBufferBlocking( device, context, forces, count, result.forces );
+}
+
+// identifies the backend and adapter that thread group sizes were tuned on
+std::string GetDeviceCacheKey( IRenderDevice *device )
+{
+    const auto &adapter = device->GetAdapterInfo();
+    std::ostringstream key;
+    key << GetRenderDeviceTypeString( device->GetDeviceInfo().Type ) << " " << std::hex << adapter.VendorId << ":" << adapter.DeviceId << std::dec << " " << adapter.Description;
+    return key.str();
+}
+
+bool LineHasDeviceKey( const std::string &line, const std::string &deviceKey )
+{
+    return line.size() > deviceKey.size() && line.compare( line.size() - deviceKey.size(), deviceKey.size(), deviceKey ) == 0;
+}
+
+bool LoadThreadGroupSizes( const std::string &deviceKey, int *sizes, int numSizes )
+{
+    std::ifstream file( ThreadGroupSizesCachePath );
+    std::string line;
+    while( std::getline( file, line ) ) {
+        if( ! LineHasDeviceKey( line, deviceKey ) ) {
+            continue;
+        }
+
+        std::istringstream stream( line );
+        std::vector<int> lineSizes( numSizes );
+        for( int &size : lineSizes ) {
+            stream >> size;
+            if( ! stream || std::find( std::begin( ThreadGroupSizeCandidates ), std::end( ThreadGroupSizeCandidates ), size ) == std::end( ThreadGroupSizeCandidates ) ) {
+                return false; // from an older build with different kernels or candidates, tune again
+            }
+        }
+        std::copy( lineSizes.begin(), lineSizes.end(), sizes );
+        return true;
+    }
+
+    return false;
+}
+
+void SaveThreadGroupSizes( const std::string &deviceKey, const int *sizes, int numSizes )
+{
+    // keep the other devices' entries
+    std::vector<std::string> lines;
+    {
+        std::ifstream file( ThreadGroupSizesCachePath );
+        std::string line;
+        while( std::getline( file, line ) ) {
+            if( ! line.empty() && ! LineHasDeviceKey( line, deviceKey ) ) {
+                lines.push_back( line );
+            }
+        }
+    }
+
+    std::ostringstream entry;
+    for( int i = 0; i < numSizes; i++ ) {
+        entry << sizes[i] << " ";
+    }
+    entry << deviceKey;
+    lines.push_back( entry.str() );
+
+    std::ofstream file( ThreadGroupSizesCachePath );
+    for( const auto &line : lines ) {
+        file << line << "\n";
+    }
+    if( ! file ) {
+        LOG_WARNING_MESSAGE( __FUNCTION__, "| failed to write ", ThreadGroupSizesCachePath );
+    }
+}
 
 // returns a quaternion that rotates vector a to vector b
 QuaternionF GetRotationQuat( const float3 &a, const float3 &b, const float3 &up )
@@ -148,7 +409,7 @@ ComputeParticles::ComputeParticles()
 {
     mParticleConstants.numParticles = 1000;
     mParticleConstants.scale = 0.22f;
-    mParticleConstants.gridSize = { 10, 10, 10 };
+    mParticleConstants.gridSize = { 0, 0, 0 }; // set from interaction distances in updateGridSize()
     mParticleConstants.worldMin = { -10, 0.1f, -10 };
     mParticleConstants.worldMax = { 10, 10, 10 };
     mParticleConstants.speedMinMax = { 0.01f, 4.0f };
@@ -162,17 +423,97 @@ ComputeParticles::ComputeParticles()
 
     mParticleConstants.sdfAvoidStrength =  100.0;
     mParticleConstants.sdfAvoidDistance = 5.0f;
+    mParticleConstants.farFieldDist = 1.0f;
 }
 
 void ComputeParticles::ModifyEngineInitInfo( const ModifyEngineInitInfoAttribs& Attribs )
 {
     SampleBase::ModifyEngineInitInfo( Attribs );
 
-    Attribs.EngineCI.Features.ComputeShaders    = DEVICE_FEATURE_STATE_ENABLED;
+    Attribs.EngineCI.Features.ComputeShaders    = DEVICE_FEATURE_STATE_OPTIONAL; // falls back to the CPU simulation
     Attribs.EngineCI.Features.TimestampQueries  = DEVICE_FEATURE_STATE_OPTIONAL;
     Attribs.EngineCI.Features.DurationQueries   = DEVICE_FEATURE_STATE_OPTIONAL;
+    Attribs.EngineCI.Features.NativeFence       = DEVICE_FEATURE_STATE_OPTIONAL; // needed to wait on fences across queues for async compute
 
     Attribs.SCDesc.DepthBufferFormat = TEX_FORMAT_UNKNOWN; // we're rendering to offscreen buffers so no need for depth buffer on the swap chain
+
+    // request a second immediate context on a compute queue so the simulation can run asynchronously.
+    // Only D3D12 and Vulkan expose more than one queue, other backends are left with the single default context.
+    if( Attribs.DeviceType != RENDER_DEVICE_TYPE_D3D12 && Attribs.DeviceType != RENDER_DEVICE_TYPE_VULKAN ) {
+        return;
+    }
+
+    Uint32 numAdapters = 0;
+    Attribs.pFactory->EnumerateAdapters( Attribs.EngineCI.GraphicsAPIVersion, numAdapters, nullptr );
+    if( numAdapters == 0 ) {
+        return;
+    }
+    std::vector<GraphicsAdapterInfo> adapters( numAdapters );
+    Attribs.pFactory->EnumerateAdapters( Attribs.EngineCI.GraphicsAPIVersion, numAdapters, adapters.data() );
+    const auto &adapter = adapters[Attribs.EngineCI.AdapterId < numAdapters ? Attribs.EngineCI.AdapterId : 0];
+
+    int graphicsQueue = -1;
+    int computeQueue = -1;
+    for( Uint32 q = 0; q < adapter.NumQueues; q++ ) {
+        const auto queueType = adapter.Queues[q].QueueType & COMMAND_QUEUE_TYPE_PRIMARY_MASK;
+        if( queueType == COMMAND_QUEUE_TYPE_GRAPHICS && graphicsQueue < 0 ) {
+            graphicsQueue = int( q );
+        }
+        else if( queueType == COMMAND_QUEUE_TYPE_COMPUTE && computeQueue < 0 ) {
+            computeQueue = int( q );
+        }
+    }
+
+    if( graphicsQueue >= 0 && computeQueue >= 0 ) {
+        ImmediateContextCIs = {
+            ImmediateContextCreateInfo{ "Graphics", Uint8( graphicsQueue ), QUEUE_PRIORITY_HIGH },
+            ImmediateContextCreateInfo{ "Async compute", Uint8( computeQueue ), QUEUE_PRIORITY_MEDIUM }
+        };
+        Attribs.EngineCI.NumImmediateContexts  = Uint32( ImmediateContextCIs.size() );
+        Attribs.EngineCI.pImmediateContextInfo = ImmediateContextCIs.data();
+    }
+}
+
+// usage: ComputeParticles [--bench <results.csv>] [--bench-warmup N] [--bench-frames N]
+SampleBase::CommandLineStatus ComputeParticles::ProcessCommandLine( int argc, const char* const* argv )
+{
+    std::string benchPath;
+    int warmupFrames = -1;
+    int measuredFrames = -1;
+    for( int i = 1; i < argc; i++ ) {
+        const std::string arg = argv[i];
+        if( arg != "--bench" && arg != "--bench-warmup" && arg != "--bench-frames" ) {
+            continue; // handled by the sample app
+        }
+        if( i + 1 >= argc ) {
+            LOG_ERROR_MESSAGE( __FUNCTION__, "| missing value for ", arg );
+            return CommandLineStatus::Error;
+        }
+
+        const char *value = argv[++i];
+        if( arg == "--bench" ) {
+            benchPath = value;
+        }
+        else if( arg == "--bench-warmup" ) {
+            warmupFrames = std::max( std::atoi( value ), 0 );
+        }
+        else {
+            measuredFrames = std::max( std::atoi( value ), 1 );
+        }
+    }
+
+    if( ! benchPath.empty() ) {
+        mBenchmark = std::make_unique<Benchmark>();
+        mBenchmark->outputPath = benchPath;
+        if( warmupFrames >= 0 ) {
+            mBenchmark->warmupFrames = warmupFrames;
+        }
+        if( measuredFrames > 0 ) {
+            mBenchmark->measuredFrames = measuredFrames;
+        }
+    }
+
+    return CommandLineStatus::OK;
 }
 
 void ComputeParticles::Initialize( const SampleInitInfo& InitInfo )
@@ -203,27 +544,66 @@ void ComputeParticles::Initialize( const SampleInitInfo& InitInfo )
         global()->colorBufferFormat = TEX_FORMAT_RGBA16_FLOAT;
     }
 
-    const auto devType = m_pDevice->GetDeviceInfo().Type;
-    if( devType == RENDER_DEVICE_TYPE_D3D11 ) {
-        // downsampling method not supported on D3D11 backend
+    mComputeShadersSupported = m_pDevice->GetDeviceInfo().Features.ComputeShaders != DEVICE_FEATURE_STATE_DISABLED;
+    if( ! mComputeShadersSupported ) {
+        LOG_WARNING_MESSAGE( __FUNCTION__, "| compute shaders not supported, particles will be updated on the CPU" );
+        mSimulationBackend = SimulationBackend::Cpu;
+        mParticleSimCpu = std::make_unique<cpusim::ParticleSimCpu>();
+        // the glow mip chain is generated with a compute pass
         mPostProcessConstants.glowEnabled = false;
     }
 
+    // the second immediate context (if any) was requested in ModifyEngineInitInfo()
+    mSimContext = m_pImmediateContext;
+    const bool nativeFences = m_pDevice->GetDeviceInfo().Features.NativeFence != DEVICE_FEATURE_STATE_DISABLED;
+    if( mComputeShadersSupported && nativeFences && InitInfo.NumImmediateCtx > 1 ) {
+        mComputeContext = InitInfo.ppContexts[1];
+        mSimContextMask = ( Uint64{1} << m_pImmediateContext->GetDesc().ContextId ) | ( Uint64{1} << mComputeContext->GetDesc().ContextId );
+
+        FenceDesc fenceDesc;
+        fenceDesc.Type = FENCE_TYPE_GENERAL;
+        fenceDesc.Name = "Graphics fence";
+        m_pDevice->CreateFence( fenceDesc, &mGraphicsFence );
+        fenceDesc.Name = "Compute fence";
+        m_pDevice->CreateFence( fenceDesc, &mComputeFence );
+        LOG_INFO_MESSAGE( __FUNCTION__, "| async compute available on queue: ", mComputeContext->GetDesc().QueueId );
+    }
+    else {
+        mAsyncCompute = false;
+    }
+
+    // created first since the update passes are profiled, which tuneThreadGroupSizes() runs during init
+    mProfiler = std::make_unique<ju::Profiler>( m_pDevice );
+
     initConsantBuffers();
     initRenderParticlePSO();
     initUpdateParticlePSO();
+    updateGridSize();
+    initSdfVolume();
     initParticleBuffers();
+    if( mComputeShadersSupported ) {
+        mDownsampler = std::make_unique<ju::post::Downsampler>();
+    }
     initPostProcessPSO();
 
 
     mBackgroundCanvas = std::make_unique<ju::Canvas>( sizeof(BackgroundPixelConstants) );
+    mBackgroundCanvas->setResolutionScale( 2 ); // the raymarch is the most expensive pass, it's upsampled into the GBuffer
+    mBackgroundCanvas->setTemporalCache( true );
+    mBackgroundCanvas->setConePrepass( true );
     initSolids();
     initCamera();
 
     mFXAA = std::make_unique<ju::post::FXAA>( m_pSwapChain->GetDesc().ColorBufferFormat );
-    mProfiler = std::make_unique<ju::Profiler>( m_pDevice );
 
     watchShadersDir();
+
+    if( mBenchmark ) {
+        startBenchmark(); // sweeps its own group sizes
+    }
+    else {
+        tuneThreadGroupSizes( true );
+    }
 }
 
 void ComputeParticles::initRenderParticlePSO()
@@ -286,7 +666,10 @@ void ComputeParticles::initRenderParticlePSO()
     psoCreateInfo.PSODesc.ResourceLayout.DefaultVariableType = SHADER_RESOURCE_VARIABLE_TYPE_STATIC;
 
     ShaderResourceVariableDesc vars[] = {
-        { SHADER_TYPE_VERTEX, "Particles", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE }
+        { SHADER_TYPE_VERTEX, "ParticlePositions", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE },
+        { SHADER_TYPE_VERTEX, "ParticleVelocities", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE },
+        { SHADER_TYPE_VERTEX, "VisibleParticleIds", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE },
+        { SHADER_TYPE_VERTEX, "ParticlePositionsPrev", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE }
     };
 
     psoCreateInfo.PSODesc.ResourceLayout.Variables    = vars;
@@ -298,14 +681,55 @@ void ComputeParticles::initRenderParticlePSO()
         if( vc ) {
             vc->Set( mParticleConstantsBuffer );
         }
+        if( auto fc = mRenderParticlePSO->GetStaticVariableByName( SHADER_TYPE_VERTEX, "FrameConstants" ) ) {
+            fc->Set( mParticleFrameConstantsBuffer );
+        }
+    }
+
+    // SRBs reference the PSO, the buffers may not exist yet during Initialize()
+    if( mParticlePositionsBuffers[0] ) {
+        initRenderParticleSRBs();
+    }
+}
+
+void ComputeParticles::initRenderParticleSRBs()
+{
+    if( ! mRenderParticlePSO ) {
+        return;
+    }
+
+    for( int i = 0; i < 2; i++ ) {
+        mRenderParticleSRBs[i].Release();
+        if( ! mParticlePositionsBuffers[i] ) {
+            continue;
+        }
+        mRenderParticlePSO->CreateShaderResourceBinding( &mRenderParticleSRBs[i], true );
+        mRenderParticleSRBs[i]->GetVariableByName( SHADER_TYPE_VERTEX, "ParticlePositions" )->Set( mParticlePositionsBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        mRenderParticleSRBs[i]->GetVariableByName( SHADER_TYPE_VERTEX, "ParticleVelocities" )->Set( mParticleVelocitiesBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        mRenderParticleSRBs[i]->GetVariableByName( SHADER_TYPE_VERTEX, "VisibleParticleIds" )->Set( mVisibleParticleIdsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        // previous step for interpolation, the CPU simulation only has one buffer (and uses an alpha of 1)
+        IBuffer* prevPositions = mParticlePositionsBuffers[1 - i] ? mParticlePositionsBuffers[1 - i] : mParticlePositionsBuffers[i];
+        mRenderParticleSRBs[i]->GetVariableByName( SHADER_TYPE_VERTEX, "ParticlePositionsPrev" )->Set( prevPositions->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
     }
 }
 
 void ComputeParticles::initUpdateParticlePSO()
 {
-    mResetParticleListsPSO.Release();
+    mResetGridCellsPSO.Release();
     mMoveParticlesPSO.Release();
+    mPrefixSumCellsPSO.Release();
+    mScatterParticlesPSO.Release();
+    mAggregateCellsPSO.Release();
     mInteractParticlesPSO.Release();
+    mCullParticlesPSO.Release();
+    mInitParticlesPSO.Release();
+    mVerletDisplacementPSO.Release();
+    mVerletCheckPSO.Release();
+    mBuildVerletListsPSO.Release();
+
+    if( ! mComputeShadersSupported ) {
+        return;
+    }
 
     // TODO: update variable names and cleanup unnecessary comments
 
@@ -318,18 +742,40 @@ void ComputeParticles::initUpdateParticlePSO()
     m_pEngineFactory->CreateDefaultShaderSourceStreamFactory( nullptr, &shaderSourceFactory );
     shaderCI.pShaderSourceStreamFactory = shaderSourceFactory;
 
+    auto addShaderMacros = [this]( ShaderMacroHelper &macros, int groupSize ) {
+        macros.AddShaderMacro( "THREAD_GROUP_SIZE", groupSize );
+        macros.AddShaderMacro( "BINNING_MODE", mBinningMode );
+        macros.AddShaderMacro( "DEBUG_PARTICLE_BUFFERS", DEBUG_PARTICLE_BUFFERS );
+        macros.AddShaderMacro( "SDF_VOLUME", mUseSdfVolume );
+        macros.AddShaderMacro( "PARTICLES_AVOID_SDF", mAvoidSdf );
+        macros.AddShaderMacro( "PARTICLES_FAR_FIELD", mFarField );
+        macros.AddShaderMacro( "VERLET_MAX_NEIGHBORS", mVerletMaxNeighbors );
+    };
+
+    // passes that aren't tuned use mThreadGroupSize
     ShaderMacroHelper shaderMacros;
-    shaderMacros.AddShaderMacro( "THREAD_GROUP_SIZE", mThreadGroupSize );
+    addShaderMacros( shaderMacros, mThreadGroupSize );
     shaderMacros.Finalize();
 
-    RefCntAutoPtr<IShader> resetParticleListsCS;
+    ShaderMacroHelper kernelMacros[NumParticleKernels];
+    for( int kernel = 0; kernel < NumParticleKernels; kernel++ ) {
+        addShaderMacros( kernelMacros[kernel], mKernelGroupSizes[kernel] );
+        kernelMacros[kernel].Finalize();
+    }
+
+    ShaderMacroHelper reorderShaderMacros;
+    addShaderMacros( reorderShaderMacros, mKernelGroupSizes[KernelMoveParticles] );
+    reorderShaderMacros.AddShaderMacro( "REORDER_PARTICLES", 1 );
+    reorderShaderMacros.Finalize();
+
+    RefCntAutoPtr<IShader> resetGridCellsCS;
     {
         shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
         shaderCI.EntryPoint      = "main";
-        shaderCI.Desc.Name       = "Reset Particle lists CS";
-        shaderCI.FilePath        = "shaders/particles/reset_particle_lists.csh";
-        shaderCI.Macros          = shaderMacros;
-        m_pDevice->CreateShader( shaderCI, &resetParticleListsCS );
+        shaderCI.Desc.Name       = "Reset Grid Cells CS";
+        shaderCI.FilePath        = "shaders/particles/reset_grid_cells.csh";
+        shaderCI.Macros          = kernelMacros[KernelResetGridCells];
+        m_pDevice->CreateShader( shaderCI, &resetGridCellsCS );
     }
 
     RefCntAutoPtr<IShader> moveParticlesCS;
@@ -338,53 +784,246 @@ void ComputeParticles::initUpdateParticlePSO()
         shaderCI.EntryPoint      = "main";
         shaderCI.Desc.Name       = "Move Particles CS";
         shaderCI.FilePath        = "shaders/particles/move_particles.csh";
-        shaderCI.Macros          = shaderMacros;
+        shaderCI.Macros          = kernelMacros[KernelMoveParticles];
         m_pDevice->CreateShader( shaderCI, &moveParticlesCS );
     }
 
+    RefCntAutoPtr<IShader> moveReorderParticlesCS;
+    {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Move Reorder Particles CS";
+        shaderCI.FilePath        = "shaders/particles/move_particles.csh";
+        shaderCI.Macros          = reorderShaderMacros;
+        m_pDevice->CreateShader( shaderCI, &moveReorderParticlesCS );
+    }
+
+    RefCntAutoPtr<IShader> prefixSumCellsCS;
+    {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Prefix Sum Cells CS";
+        shaderCI.FilePath        = "shaders/particles/prefix_sum_cells.csh";
+        shaderCI.Macros          = kernelMacros[KernelPrefixSumCells];
+        m_pDevice->CreateShader( shaderCI, &prefixSumCellsCS );
+    }
+
+    RefCntAutoPtr<IShader> scatterParticlesCS;
+    {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Scatter Particles CS";
+        shaderCI.FilePath        = "shaders/particles/scatter_particles.csh";
+        shaderCI.Macros          = kernelMacros[KernelScatterParticles];
+        m_pDevice->CreateShader( shaderCI, &scatterParticlesCS );
+    }
+
+    RefCntAutoPtr<IShader> aggregateCellsCS;
+    if( mFarField && mBinningMode == 1 ) {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Aggregate Cells CS";
+        shaderCI.FilePath        = "shaders/particles/aggregate_cells.csh";
+        shaderCI.Macros          = shaderMacros;
+        m_pDevice->CreateShader( shaderCI, &aggregateCellsCS );
+    }
+
     RefCntAutoPtr<IShader> interactParticlesCS;
     {
         shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
         shaderCI.EntryPoint      = "main";
         shaderCI.Desc.Name       = "Interact Particles CS";
         shaderCI.FilePath        = "shaders/particles/interact_particles.csh";
-        shaderCI.Macros          = shaderMacros;
+        shaderCI.Macros          = kernelMacros[KernelInteractParticles];
         m_pDevice->CreateShader( shaderCI, &interactParticlesCS );
     }
 
+    RefCntAutoPtr<IShader> bakeSdfCS;
+    {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Bake SDF CS";
+        shaderCI.FilePath        = "shaders/particles/bake_sdf.csh";
+        shaderCI.Macros          = shaderMacros;
+        m_pDevice->CreateShader( shaderCI, &bakeSdfCS );
+    }
+
+    RefCntAutoPtr<IShader> mortonKeysCS;
+    {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Morton Keys CS";
+        shaderCI.FilePath        = "shaders/particles/morton_keys.csh";
+        shaderCI.Macros          = kernelMacros[KernelSortParticles];
+        m_pDevice->CreateShader( shaderCI, &mortonKeysCS );
+    }
+
+    RefCntAutoPtr<IShader> radixSortCountCS;
+    {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Radix Sort Count CS";
+        shaderCI.FilePath        = "shaders/particles/radix_sort_count.csh";
+        shaderCI.Macros          = kernelMacros[KernelSortParticles];
+        m_pDevice->CreateShader( shaderCI, &radixSortCountCS );
+    }
+
+    RefCntAutoPtr<IShader> radixSortScanCS;
+    {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Radix Sort Scan CS";
+        shaderCI.FilePath        = "shaders/particles/radix_sort_scan.csh";
+        shaderCI.Macros          = kernelMacros[KernelSortParticles];
+        m_pDevice->CreateShader( shaderCI, &radixSortScanCS );
+    }
+
+    RefCntAutoPtr<IShader> radixSortScatterCS;
+    {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Radix Sort Scatter CS";
+        shaderCI.FilePath        = "shaders/particles/radix_sort_scatter.csh";
+        shaderCI.Macros          = kernelMacros[KernelSortParticles];
+        m_pDevice->CreateShader( shaderCI, &radixSortScatterCS );
+    }
+
+    RefCntAutoPtr<IShader> cullParticlesCS;
+    {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Cull Particles CS";
+        shaderCI.FilePath        = "shaders/particles/cull_particles.csh";
+        shaderCI.Macros          = shaderMacros;
+        m_pDevice->CreateShader( shaderCI, &cullParticlesCS );
+    }
+
+    RefCntAutoPtr<IShader> initParticlesCS;
+    {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+        shaderCI.Desc.Name       = "Init Particles CS";
+        shaderCI.FilePath        = "shaders/particles/init_particles.csh";
+        shaderCI.Macros          = shaderMacros;
+        m_pDevice->CreateShader( shaderCI, &initParticlesCS );
+    }
+
+    // verlet list passes are only used in binning mode 3
+    RefCntAutoPtr<IShader> verletDisplacementCS, verletCheckCS, buildVerletListsCS;
+    if( mBinningMode == 3 ) {
+        shaderCI.Desc.ShaderType = SHADER_TYPE_COMPUTE;
+        shaderCI.EntryPoint      = "main";
+
+        shaderCI.Desc.Name       = "Verlet Displacement CS";
+        shaderCI.FilePath        = "shaders/particles/verlet_displacement.csh";
+        shaderCI.Macros          = shaderMacros;
+        m_pDevice->CreateShader( shaderCI, &verletDisplacementCS );
+
+        shaderCI.Desc.Name       = "Build Verlet Lists CS";
+        shaderCI.FilePath        = "shaders/particles/build_verlet_lists.csh";
+        shaderCI.Macros          = shaderMacros;
+        m_pDevice->CreateShader( shaderCI, &buildVerletListsCS );
+
+        // writes the indirect args for the passes that rebuild the lists, so it needs their group sizes
+        ShaderMacroHelper checkMacros;
+        checkMacros.AddShaderMacro( "SCATTER_THREAD_GROUP_SIZE", mKernelGroupSizes[KernelScatterParticles] );
+        checkMacros.AddShaderMacro( "BUILD_THREAD_GROUP_SIZE", mThreadGroupSize );
+        checkMacros.Finalize();
+        shaderCI.Desc.Name       = "Verlet Check CS";
+        shaderCI.FilePath        = "shaders/particles/verlet_check.csh";
+        shaderCI.Macros          = checkMacros;
+        m_pDevice->CreateShader( shaderCI, &verletCheckCS );
+    }
+
     ComputePipelineStateCreateInfo psoCI;
     PipelineStateDesc&             psoDesc = psoCI.PSODesc;
 
     // init compute pipeline
     psoDesc.PipelineType = PIPELINE_TYPE_COMPUTE;
+    psoDesc.ImmediateContextMask = mSimContextMask;
     psoDesc.ResourceLayout.DefaultVariableType = SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE;
     ShaderResourceVariableDesc shaderVars[] = {
-        { SHADER_TYPE_COMPUTE, "Constants", SHADER_RESOURCE_VARIABLE_TYPE_STATIC }
+        { SHADER_TYPE_COMPUTE, "Constants", SHADER_RESOURCE_VARIABLE_TYPE_STATIC },
+        { SHADER_TYPE_COMPUTE, "FrameConstants", SHADER_RESOURCE_VARIABLE_TYPE_STATIC },
+        { SHADER_TYPE_COMPUTE, "SortConstants", SHADER_RESOURCE_VARIABLE_TYPE_STATIC },
+        { SHADER_TYPE_COMPUTE, "CullConstants", SHADER_RESOURCE_VARIABLE_TYPE_STATIC },
+        { SHADER_TYPE_COMPUTE, "InitConstants", SHADER_RESOURCE_VARIABLE_TYPE_STATIC },
+        { SHADER_TYPE_COMPUTE, "VerletConstants", SHADER_RESOURCE_VARIABLE_TYPE_STATIC }
     };
     psoDesc.ResourceLayout.Variables    = shaderVars;
     psoDesc.ResourceLayout.NumVariables = _countof(shaderVars);
 
-    psoDesc.Name = "Reset particle lists PSO";
-    psoCI.pCS = resetParticleListsCS;
-    m_pDevice->CreateComputePipelineState( psoCI, &mResetParticleListsPSO );
-    if( auto var = mResetParticleListsPSO->GetStaticVariableByName( SHADER_TYPE_COMPUTE, "Constants" ) ) {
-        var->Set( mParticleConstantsBuffer );
+    auto createPSO = [&]( const char* name, IShader* shader, RefCntAutoPtr<IPipelineState>& pso ) {
+        psoDesc.Name = name;
+        psoCI.pCS = shader;
+        m_pDevice->CreateComputePipelineState( psoCI, &pso );
+        if( pso ) {
+            if( auto var = pso->GetStaticVariableByName( SHADER_TYPE_COMPUTE, "Constants" ) ) {
+                var->Set( mParticleConstantsBuffer );
+            }
+            if( auto var = pso->GetStaticVariableByName( SHADER_TYPE_COMPUTE, "FrameConstants" ) ) {
+                var->Set( mParticleFrameConstantsBuffer );
+            }
+            if( auto var = pso->GetStaticVariableByName( SHADER_TYPE_COMPUTE, "SortConstants" ) ) {
+                var->Set( mRadixSortConstantsBuffer );
+            }
+            if( auto var = pso->GetStaticVariableByName( SHADER_TYPE_COMPUTE, "CullConstants" ) ) {
+                var->Set( mCullConstantsBuffer );
+            }
+            if( auto var = pso->GetStaticVariableByName( SHADER_TYPE_COMPUTE, "InitConstants" ) ) {
+                var->Set( mParticleInitConstantsBuffer );
+            }
+            if( auto var = pso->GetStaticVariableByName( SHADER_TYPE_COMPUTE, "VerletConstants" ) ) {
+                var->Set( mVerletConstantsBuffer );
+            }
+        }
+    };
+
+    createPSO( "Reset grid cells PSO", resetGridCellsCS, mResetGridCellsPSO );
+    createPSO( "Move particles PSO", moveParticlesCS, mMoveParticlesPSO );
+    createPSO( "Move reorder particles PSO", moveReorderParticlesCS, mMoveReorderParticlesPSO );
+    createPSO( "Prefix sum cells PSO", prefixSumCellsCS, mPrefixSumCellsPSO );
+    createPSO( "Scatter particles PSO", scatterParticlesCS, mScatterParticlesPSO );
+    if( aggregateCellsCS ) {
+        createPSO( "Aggregate cells PSO", aggregateCellsCS, mAggregateCellsPSO );
     }
+    createPSO( "Bake SDF PSO", bakeSdfCS, mBakeSdfPSO );
 
-    psoDesc.Name = "Move particles PSO";
-    psoCI.pCS = moveParticlesCS;
-    m_pDevice->CreateComputePipelineState( psoCI, &mMoveParticlesPSO );
-    if( mMoveParticlesPSO ) {
-        if( auto var = mMoveParticlesPSO->GetStaticVariableByName( SHADER_TYPE_COMPUTE, "Constants" ) ) {
-            var->Set( mParticleConstantsBuffer );
-        }
+    // the baked sdf volume is filtered when sampled in the interact pass
+    const SamplerDesc samLinearClampDesc {
+        FILTER_TYPE_LINEAR, FILTER_TYPE_LINEAR, FILTER_TYPE_LINEAR,
+        TEXTURE_ADDRESS_CLAMP, TEXTURE_ADDRESS_CLAMP, TEXTURE_ADDRESS_CLAMP
+    };
+    const ImmutableSamplerDesc immutableSamplers[] = {
+        { SHADER_TYPE_COMPUTE, "SdfVolume", samLinearClampDesc }
+    };
+    psoDesc.ResourceLayout.ImmutableSamplers    = immutableSamplers;
+    psoDesc.ResourceLayout.NumImmutableSamplers = _countof(immutableSamplers);
+    createPSO( "Interact particles PSO", interactParticlesCS, mInteractParticlesPSO );
+    psoDesc.ResourceLayout.ImmutableSamplers    = nullptr;
+    psoDesc.ResourceLayout.NumImmutableSamplers = 0;
+
+    createPSO( "Morton keys PSO", mortonKeysCS, mMortonKeysPSO );
+    createPSO( "Radix sort count PSO", radixSortCountCS, mRadixSortCountPSO );
+    createPSO( "Radix sort scan PSO", radixSortScanCS, mRadixSortScanPSO );
+    createPSO( "Radix sort scatter PSO", radixSortScatterCS, mRadixSortScatterPSO );
+    // culling always runs on the immediate context and reads the dynamic FrameConstants buffer, which can only live there
+    psoDesc.ImmediateContextMask = Uint64{1} << m_pImmediateContext->GetDesc().ContextId;
+    createPSO( "Cull particles PSO", cullParticlesCS, mCullParticlesPSO );
+    psoDesc.ImmediateContextMask = mSimContextMask;
+    createPSO( "Init particles PSO", initParticlesCS, mInitParticlesPSO );
+    if( mBinningMode == 3 ) {
+        createPSO( "Verlet displacement PSO", verletDisplacementCS, mVerletDisplacementPSO );
+        createPSO( "Verlet check PSO", verletCheckCS, mVerletCheckPSO );
+        createPSO( "Build verlet lists PSO", buildVerletListsCS, mBuildVerletListsPSO );
     }
 
-    psoDesc.Name = "Interact particles PSO";
-    psoCI.pCS = interactParticlesCS;
-    m_pDevice->CreateComputePipelineState( psoCI, &mInteractParticlesPSO );
-    if( mInteractParticlesPSO ) {
-        mInteractParticlesPSO->GetStaticVariableByName( SHADER_TYPE_COMPUTE, "Constants" )->Set( mParticleConstantsBuffer );
+    // sdf_scene() may have changed
+    mSdfVolumeDirty = true;
+
+    // SRBs reference the PSOs, so they need to be recreated (the buffers may not exist yet during Initialize())
+    if( mParticlePositionsBuffers[0] && mGridCellCountsBuffer ) {
+        initUpdateParticleSRBs();
     }
 }
 
@@ -405,16 +1044,27 @@ void ComputeParticles::initSolids()
 
     // make the Solid that will get used for instanced drawing of particles
     {
-        IBufferView* particleAttribsBufferSRV = mParticleAttribsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE );
 
         ju::Solid::Options options;
         options.components = ju::VERTEX_COMPONENT_FLAG_POS_NORM_UV;
         options.vertPath = "shaders/particles/particle_solid.vsh";
         options.pixelPath = "shaders/particles/particle_solid.psh";
         options.name = "Particle Solid";
-        options.shaderResourceVars.push_back( { { SHADER_TYPE_VERTEX, "Particles", SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE }, particleAttribsBufferSRV } );
-        options.staticShaderVars.push_back( { SHADER_TYPE_VERTEX, "PConstants", mParticleConstantsBuffer } );
-        options.staticShaderVars.push_back( { SHADER_TYPE_PIXEL, "PConstants", mParticleConstantsBuffer } );
+        // positions and velocities swap buffers every frame and all of them are reallocated when the capacity grows (see drawParticles())
+        options.shaderResourceVars.push_back( { { SHADER_TYPE_VERTEX, "ParticleVelocities", SHADER_RESOURCE_VARIABLE_TYPE_DYNAMIC }, mParticleVelocitiesBuffers[mParticleStateIndex]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) } );
+        // the cull pass writes a transform per instance, without compute shaders the vertex shader builds it from the positions
+        options.macros.push_back( { "PARTICLE_TRANSFORMS", mParticleTransformsBuffer ? 1 : 0 } );
+        if( mParticleTransformsBuffer ) {
+            options.shaderResourceVars.push_back( { { SHADER_TYPE_VERTEX, "ParticleTransforms", SHADER_RESOURCE_VARIABLE_TYPE_DYNAMIC }, mParticleTransformsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) } );
+        }
+        else {
+            options.shaderResourceVars.push_back( { { SHADER_TYPE_VERTEX, "ParticlePositions", SHADER_RESOURCE_VARIABLE_TYPE_DYNAMIC }, mParticlePositionsBuffers[mParticleStateIndex]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) } );
+            options.shaderResourceVars.push_back( { { SHADER_TYPE_VERTEX, "ParticlePositionsPrev", SHADER_RESOURCE_VARIABLE_TYPE_DYNAMIC }, mParticlePositionsBuffers[mParticleStateIndex]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) } );
+            options.staticShaderVars.push_back( { SHADER_TYPE_VERTEX, "PConstants", mParticleConstantsBuffer } );
+            options.staticShaderVars.push_back( { SHADER_TYPE_VERTEX, "FConstants", mParticleFrameConstantsBuffer } );
+        }
+        options.shaderResourceVars.push_back( { { SHADER_TYPE_VERTEX, "ParticleForces", SHADER_RESOURCE_VARIABLE_TYPE_DYNAMIC }, mParticleForcesBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) } );
+        options.shaderResourceVars.push_back( { { SHADER_TYPE_VERTEX, "VisibleParticleIds", SHADER_RESOURCE_VARIABLE_TYPE_DYNAMIC }, mVisibleParticleIdsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) } );
 
         if( mParticleType == ParticleType::Cube ) {
             mParticleSolid = std::make_unique<ju::Cube>( options );
@@ -425,142 +1075,677 @@ void ComputeParticles::initSolids()
     }
 }
 
+// Reallocates the particle buffers to fit exactly numParticles and spawns all of them
 void ComputeParticles::initParticleBuffers()
 {
-    mParticleAttribsBuffer.Release();
-    mParticleListHeadsBuffer.Release();
-    mParticleListsBuffer.Release();
+    waitForAsyncSimulation();
+    mSimulationClock.reset();
+    createParticleBuffers( mParticleConstants.numParticles );
+    spawnParticles( 0, mParticleConstants.numParticles );
+}
+
+// Changes the active particle count. Existing particles are kept and only the new ones are spawned,
+// buffers are reallocated (growing geometrically) only when numParticles exceeds the current capacity.
+void ComputeParticles::resizeParticles( int numParticles )
+{
+    waitForAsyncSimulation();
+
+    if( fitThreadGroupSizes( numParticles ) ) {
+        initUpdateParticlePSO();
+    }
+
+    if( ! mInitParticlesPSO || mSimulationBackend == SimulationBackend::Cpu ) {
+        // the CPU simulation owns the particle state, start it over at the new count
+        mParticleConstants.numParticles = numParticles;
+        mParticleConstantsDirty = true;
+        initParticleBuffers();
+        return;
+    }
+
+    const int prevNumParticles = mParticleConstants.numParticles;
+    if( numParticles > mParticleCapacity ) {
+        // keep the current state, it's copied into the new buffers
+        RefCntAutoPtr<IBuffer> positions = mParticlePositionsBuffers[mParticleStateIndex];
+        RefCntAutoPtr<IBuffer> velocities = mParticleVelocitiesBuffers[mParticleStateIndex];
+        RefCntAutoPtr<IBuffer> forces = mParticleForcesBuffer;
+
+        createParticleBuffers( std::max( numParticles, mParticleCapacity * 2 ) );
+
+        const Uint64 streamSize = Uint64( prevNumParticles ) * sizeof(float4);
+        m_pImmediateContext->CopyBuffer( positions, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION, mParticlePositionsBuffers[0], 0, streamSize, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        m_pImmediateContext->CopyBuffer( velocities, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION, mParticleVelocitiesBuffers[0], 0, streamSize, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        m_pImmediateContext->CopyBuffer( forces, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION, mParticleForcesBuffer, 0, streamSize, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    }
+
+    // shrinking only lowers the active count, the buffers keep their capacity
+    mParticleConstants.numParticles = numParticles;
+    mParticleConstantsDirty = true;
+    if( numParticles > prevNumParticles ) {
+        spawnParticles( prevNumParticles, numParticles - prevNumParticles );
+    }
+}
+
+// Creates all per-particle buffers with room for capacity particles, and (re)binds them to the SRBs. Particle state is left uninitialized.
+void ComputeParticles::createParticleBuffers( int capacity )
+{
+    for( int i = 0; i < 2; i++ ) {
+        mParticlePositionsBuffers[i].Release();
+        mParticleVelocitiesBuffers[i].Release();
+    }
+    mParticleStateIndex = 0;
+    mPrevParticleStateValid = false;
+    mParticleCapacity = capacity;
+    mParticleForcesBuffer.Release();
+    mParticleCellsBuffer.Release();
+    mSortedParticleIdsBuffer.Release();
+    for( int i = 0; i < 2; i++ ) {
+        mSortKeysBuffers[i].Release();
+        mSortValuesBuffers[i].Release();
+    }
+    mBlockDigitCountsBuffer.Release();
+    mBlockDigitOffsetsBuffer.Release();
+    mVisibleParticleIdsBuffer.Release();
+    mParticleTransformsBuffer.Release();
 #if DEBUG_PARTICLE_BUFFERS
-    mParticleAttribsStaging.Release();
-    mParticleListsStaging.Release();
-    mParticleListsHeadStaging.Release();
-    mFenceParticleAttribsAvailable.Release();
+    mParticleDebugBuffer.Release();
 #endif
 
     BufferDesc BuffDesc;
-    BuffDesc.Name              = "Particle attribs buffer";
     BuffDesc.Usage             = USAGE_DEFAULT;
-    BuffDesc.BindFlags         = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+    BuffDesc.BindFlags         = BIND_SHADER_RESOURCE | ( mComputeShadersSupported ? BIND_UNORDERED_ACCESS : BIND_NONE );
     BuffDesc.Mode              = BUFFER_MODE_STRUCTURED;
-    BuffDesc.ElementByteStride = sizeof(ParticleAttribs);
-    BuffDesc.Size              = sizeof(ParticleAttribs) * mParticleConstants.numParticles;
-
-    std::vector<ParticleAttribs> ParticleData( mParticleConstants.numParticles );
-
-    // Standard mersenne_twister_engine. Use default seed to generate consistent distribution.
-    // TODO: try with float3 template argument (once working
-    std::mt19937 gen;
-    float3 birthMin = mParticleConstants.worldMin * ( 1.0f - mParticleBirthPadding );
-    float3 birthMax = mParticleConstants.worldMax * ( 1.0f - mParticleBirthPadding );
-    float speed = ( mParticleConstants.speedMinMax.y - mParticleConstants.speedMinMax.x ) / 2.0f;
-
-    std::uniform_real_distribution<float> posDistrX( birthMin.x, birthMax.x );
-    std::uniform_real_distribution<float> posDistrY( birthMin.y, birthMax.y );
-    std::uniform_real_distribution<float> posDistrZ( birthMin.z, birthMax.z );
-    std::uniform_real_distribution<float> speedDistr( - speed - mParticleSpeedVariation, speed + mParticleSpeedVariation );
-    std::uniform_real_distribution<float> sizeDistr( 1.0f - mParticleScaleVariation, 1.0f + mParticleScaleVariation );
-
-    for ( auto &particle : ParticleData ) {
-        particle.newPos.x = posDistrX( gen );
-        particle.newPos.y = posDistrY( gen );
-        particle.newPos.z = posDistrZ( gen );
-        particle.newVel.y = speedDistr( gen );
-        particle.newVel.z = speedDistr( gen );
-        particle.newVel.x = speedDistr( gen );
-        particle.size     = sizeDistr( gen );
-    }
-
-    BufferData VBData;
-    VBData.pData    = ParticleData.data();
-    VBData.DataSize = sizeof(ParticleAttribs) * static_cast<Uint32>( ParticleData.size() );
-    m_pDevice->CreateBuffer( BuffDesc, &VBData, &mParticleAttribsBuffer );
-    IBufferView* particleAttribsBufferSRV = mParticleAttribsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE );
-    IBufferView* particleAttribsBufferUAV = mParticleAttribsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS );
+    BuffDesc.ImmediateContextMask = mSimContextMask;
 
-    BuffDesc.ElementByteStride = sizeof(int);
-    BuffDesc.Mode              = BUFFER_MODE_FORMATTED;
-    BuffDesc.Size              = Uint64{BuffDesc.ElementByteStride} * static_cast<Uint64>( mParticleConstants.numParticles );
-    BuffDesc.BindFlags         = BIND_UNORDERED_ACCESS | BIND_SHADER_RESOURCE;
-    m_pDevice->CreateBuffer( BuffDesc, nullptr, &mParticleListHeadsBuffer );
-    m_pDevice->CreateBuffer( BuffDesc, nullptr, &mParticleListsBuffer );
-    RefCntAutoPtr<IBufferView> particleListHeadsBufferUAV;
-    RefCntAutoPtr<IBufferView> particleListsBufferUAV;
-    RefCntAutoPtr<IBufferView> particleListHeadsBufferSRV;
-    RefCntAutoPtr<IBufferView> particleListsBufferSRV;
-    {
-        BufferViewDesc ViewDesc;
-        ViewDesc.ViewType             = BUFFER_VIEW_UNORDERED_ACCESS;
-        ViewDesc.Format.ValueType     = VT_INT32;
-        ViewDesc.Format.NumComponents = 1;
-        mParticleListHeadsBuffer->CreateView( ViewDesc, &particleListHeadsBufferUAV );
-        mParticleListsBuffer->CreateView( ViewDesc, &particleListsBufferUAV );
+    auto createBuffer = [&]( const char* name, Uint32 stride, RefCntAutoPtr<IBuffer>& buffer ) {
+        BuffDesc.Name              = name;
+        BuffDesc.ElementByteStride = stride;
+        BuffDesc.Size              = Uint64( stride ) * capacity;
+        m_pDevice->CreateBuffer( BuffDesc, nullptr, &buffer );
+    };
 
-        ViewDesc.ViewType = BUFFER_VIEW_SHADER_RESOURCE;
-        mParticleListHeadsBuffer->CreateView( ViewDesc, &particleListHeadsBufferSRV );
-        mParticleListsBuffer->CreateView( ViewDesc, &particleListsBufferSRV );
-    }
+    createBuffer( "Particle positions buffer 0", sizeof(float4), mParticlePositionsBuffers[0] );
+    createBuffer( "Particle velocities buffer 0", sizeof(float4), mParticleVelocitiesBuffers[0] );
+    createBuffer( "Particle forces buffer", sizeof(float4), mParticleForcesBuffer );
+    createBuffer( "Visible particle ids buffer", sizeof(int), mVisibleParticleIdsBuffer );
 
+    if( mComputeShadersSupported ) {
+        // written by the first move pass, the CPU simulation only uses buffer 0
+        createBuffer( "Particle positions buffer 1", sizeof(float4), mParticlePositionsBuffers[1] );
+        createBuffer( "Particle velocities buffer 1", sizeof(float4), mParticleVelocitiesBuffers[1] );
 #if DEBUG_PARTICLE_BUFFERS
-    // make a staging buffer to read back
-    {
-        BufferDesc bufferDescStaging;
-
-        bufferDescStaging.Name           = "ParticleAttribs staging buffer";
-        bufferDescStaging.Usage          = USAGE_STAGING;
-        bufferDescStaging.BindFlags      = BIND_NONE;
-        bufferDescStaging.Mode           = BUFFER_MODE_UNDEFINED;
-        bufferDescStaging.CPUAccessFlags = CPU_ACCESS_READ;
-        bufferDescStaging.Size           = sizeof(ParticleAttribs) * mParticleConstants.numParticles;
-        m_pDevice->CreateBuffer( bufferDescStaging, nullptr, &mParticleAttribsStaging );
-        VERIFY_EXPR( mParticleAttribsStaging != nullptr );
-
-        bufferDescStaging.Name           = "ParticleLists staging buffer";
-        bufferDescStaging.Size           = sizeof(int) * mParticleConstants.numParticles;
-        m_pDevice->CreateBuffer( bufferDescStaging, nullptr, &mParticleListsStaging );
-        VERIFY_EXPR( mParticleListsStaging != nullptr );
-
-        bufferDescStaging.Name           = "ParticleListsHead staging buffer";
-        bufferDescStaging.Size           = sizeof(int) * mParticleConstants.numParticles;
-        m_pDevice->CreateBuffer( bufferDescStaging, nullptr, &mParticleListsHeadStaging );
-        VERIFY_EXPR( mParticleListsStaging != nullptr );
+        createBuffer( "Particle debug attribs buffer", sizeof(ParticleDebugAttribs), mParticleDebugBuffer );
+#endif
+        // per-particle grid buffers
+        createBuffer( "Particle cells buffer", sizeof(int2), mParticleCellsBuffer );
+        createBuffer( "Sorted particle ids buffer", sizeof(int), mSortedParticleIdsBuffer );
+        // written by the cull pass for mesh particles
+        createBuffer( "Particle transforms buffer", ParticleTransformSize, mParticleTransformsBuffer );
+
+        // Morton order sort, keys and values are ping-ponged between sort passes
+        createBuffer( "Sort keys buffer 0", sizeof(Uint32), mSortKeysBuffers[0] );
+        createBuffer( "Sort keys buffer 1", sizeof(Uint32), mSortKeysBuffers[1] );
+        createBuffer( "Sort values buffer 0", sizeof(int), mSortValuesBuffers[0] );
+        createBuffer( "Sort values buffer 1", sizeof(int), mSortValuesBuffers[1] );
+
+        // per block digit counts, RadixSortBins for each thread group of the sort passes
+        const Uint32 sortGroupSize = Uint32( mKernelGroupSizes[KernelSortParticles] );
+        const Uint32 numBlocks = ( capacity + sortGroupSize - 1 ) / sortGroupSize;
+        BuffDesc.ElementByteStride = sizeof(int);
+        BuffDesc.Size              = sizeof(int) * RadixSortBins * numBlocks;
+        BuffDesc.Name              = "Block digit counts buffer";
+        m_pDevice->CreateBuffer( BuffDesc, nullptr, &mBlockDigitCountsBuffer );
+        BuffDesc.Name              = "Block digit offsets buffer";
+        m_pDevice->CreateBuffer( BuffDesc, nullptr, &mBlockDigitOffsetsBuffer );
+
+        // indirect draw args, NumInstances is written by the cull pass. Doesn't depend on the capacity so it's only made once
+        if( ! mDrawArgsBuffer ) {
+            BufferDesc drawArgsDesc;
+            drawArgsDesc.Name              = "Particle draw args buffer";
+            drawArgsDesc.Usage             = USAGE_DEFAULT;
+            drawArgsDesc.BindFlags         = BIND_INDIRECT_DRAW_ARGS | BIND_UNORDERED_ACCESS;
+            drawArgsDesc.Mode              = BUFFER_MODE_RAW;
+            drawArgsDesc.ElementByteStride = sizeof(Uint32);
+            drawArgsDesc.Size              = sizeof(Uint32) * NumDrawArgs;
+            m_pDevice->CreateBuffer( drawArgsDesc, nullptr, &mDrawArgsBuffer );
+
+            mDrawArgsReadback = std::make_unique<ju::ReadbackBuffer>( m_pDevice, "Particle draw args", sizeof(Uint32) * NumDrawArgs );
+        }
+    }
 
-        FenceDesc fenceDesc;
-        fenceDesc.Name = "ParticleAttribs available";
-        m_pDevice->CreateFence( fenceDesc, &mFenceParticleAttribsAvailable );
+#if DEBUG_PARTICLE_BUFFERS
+    // readback rings for the debug windows, only a window of MaxDebugParticles is ever copied so they're only made once
+    if( ! mParticlePositionsReadback ) {
+        const size_t maxCount = size_t( MaxDebugParticles );
+        // copied on whichever context runs the simulation
+        const size_t depth = 3;
+        mParticlePositionsReadback  = std::make_unique<ju::ReadbackBuffer>( m_pDevice, "ParticlePositions", sizeof(float4) * maxCount, depth, mSimContextMask );
+        mParticleVelocitiesReadback = std::make_unique<ju::ReadbackBuffer>( m_pDevice, "ParticleVelocities", sizeof(float4) * maxCount, depth, mSimContextMask );
+        mParticleForcesReadback     = std::make_unique<ju::ReadbackBuffer>( m_pDevice, "ParticleForces", sizeof(float4) * maxCount, depth, mSimContextMask );
+        mParticleDebugReadback      = std::make_unique<ju::ReadbackBuffer>( m_pDevice, "ParticleDebugAttribs", sizeof(ParticleDebugAttribs) * maxCount, depth, mSimContextMask );
+        mParticleCellsReadback      = std::make_unique<ju::ReadbackBuffer>( m_pDevice, "ParticleCells", sizeof(int2) * maxCount, depth, mSimContextMask );
+        mSortedParticleIdsReadback  = std::make_unique<ju::ReadbackBuffer>( m_pDevice, "SortedParticleIds", sizeof(int) * maxCount, depth, mSimContextMask );
     }
 #endif
 
-    if( mResetParticleListsPSO ) {
-        mResetParticleListsSRB.Release();
-        mResetParticleListsPSO->CreateShaderResourceBinding( &mResetParticleListsSRB, true );
-        mResetParticleListsSRB->GetVariableByName(SHADER_TYPE_COMPUTE, "ParticleListHead")->Set( particleListHeadsBufferUAV );
+    initVerletBuffers();
+    initRenderParticleSRBs();
+    initUpdateParticleSRBs();
+}
+
+// Writes the initial state of particles [first, first + count) into the current buffers
+void ComputeParticles::spawnParticles( int first, int count )
+{
+    if( count <= 0 ) {
+        return;
     }
-    if( mRenderParticlePSO ) {
-        mRenderParticleSRB.Release();
-        mRenderParticlePSO->CreateShaderResourceBinding( &mRenderParticleSRB, true );
-        mRenderParticleSRB->GetVariableByName( SHADER_TYPE_VERTEX, "Particles" )->Set( particleAttribsBufferSRV );
+
+    // the previous state buffer doesn't have the new particles
+    mPrevParticleStateValid = false;
+    mVerletRebuildPending = true;
+
+    ParticleInitConstants initConstants;
+    initConstants.birthMin      = mParticleConstants.worldMin * ( 1.0f - mParticleBirthPadding );
+    initConstants.birthMax      = mParticleConstants.worldMax * ( 1.0f - mParticleBirthPadding );
+    initConstants.speedRange    = ( mParticleConstants.speedMinMax.y - mParticleConstants.speedMinMax.x ) / 2.0f + mParticleSpeedVariation;
+    initConstants.sizeVariation = mParticleScaleVariation;
+    initConstants.seed          = Uint32( mParticleSeed );
+    initConstants.firstParticle = first;
+    initConstants.numParticles  = count;
+
+    // the initial state is written by init_particles.csh when possible, the CPU simulation needs its own copy so it's filled here instead
+    if( mInitParticlesPSO && mSimulationBackend == SimulationBackend::Gpu ) {
+        m_pImmediateContext->UpdateBuffer( mParticleInitConstantsBuffer, 0, sizeof(initConstants), &initConstants, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+        // only used here, so the SRB isn't kept around
+        RefCntAutoPtr<IShaderResourceBinding> srb;
+        mInitParticlesPSO->CreateShaderResourceBinding( &srb, true );
+        srb->GetVariableByName( SHADER_TYPE_COMPUTE, "ParticlePositions" )->Set( mParticlePositionsBuffers[mParticleStateIndex]->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        srb->GetVariableByName( SHADER_TYPE_COMPUTE, "ParticleVelocities" )->Set( mParticleVelocitiesBuffers[mParticleStateIndex]->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        srb->GetVariableByName( SHADER_TYPE_COMPUTE, "ParticleForces" )->Set( mParticleForcesBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        srb->GetVariableByName( SHADER_TYPE_COMPUTE, "VisibleParticleIds" )->Set( mVisibleParticleIdsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+
+        DispatchComputeAttribs dispatchAttribs;
+        dispatchAttribs.ThreadGroupCountX = ( count + mThreadGroupSize - 1) / mThreadGroupSize;
+
+        m_pImmediateContext->SetPipelineState( mInitParticlesPSO );
+        m_pImmediateContext->CommitShaderResources( srb, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        m_pImmediateContext->DispatchCompute( dispatchAttribs );
+        return;
+    }
+
+    ParticleStateData particleData;
+    InitParticlesCpu( initConstants, particleData );
+    // every particle in order, so drawing still works without the cull pass
+    std::vector<int> visibleParticleIds( count );
+    std::iota( visibleParticleIds.begin(), visibleParticleIds.end(), first );
+
+    const Uint64 offset = Uint64( first ) * sizeof(float4);
+    const Uint64 streamSize = Uint64( count ) * sizeof(float4);
+    m_pImmediateContext->UpdateBuffer( mParticlePositionsBuffers[mParticleStateIndex], offset, streamSize, particleData.positions.data(), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    m_pImmediateContext->UpdateBuffer( mParticleVelocitiesBuffers[mParticleStateIndex], offset, streamSize, particleData.velocities.data(), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    m_pImmediateContext->UpdateBuffer( mParticleForcesBuffer, offset, streamSize, particleData.forces.data(), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    m_pImmediateContext->UpdateBuffer( mVisibleParticleIdsBuffer, Uint64( first ) * sizeof(int), Uint64( count ) * sizeof(int), visibleParticleIds.data(), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+    // only reached with first == 0 (see resizeParticles()), so this is the whole particle set
+    if( mParticleSimCpu ) {
+        mParticleSimCpu->setParticles( particleData.cpuSimStreams(), count );
+    }
+}
+
+// Per-cell buffers, sized by the number of grid cells (not particles)
+void ComputeParticles::initGridBuffers()
+{
+    mGridCellCountsBuffer.Release();
+    mGridCellOffsetsBuffer.Release();
+    mGridCellCentersBuffer.Release();
+    mGridCellHeadingsBuffer.Release();
+
+    if( ! mComputeShadersSupported ) {
+        return;
+    }
+
+    const int3 &gridSize = mParticleConstants.gridSize;
+    const Uint32 numCells = Uint32( gridSize.x * gridSize.y * gridSize.z );
+
+    BufferDesc BuffDesc;
+    BuffDesc.Usage             = USAGE_DEFAULT;
+    BuffDesc.BindFlags         = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+    BuffDesc.Mode              = BUFFER_MODE_STRUCTURED;
+    BuffDesc.ElementByteStride = sizeof(int);
+    BuffDesc.Size              = sizeof(int) * numCells;
+    BuffDesc.ImmediateContextMask = mSimContextMask;
+
+    BuffDesc.Name = "Grid cell counts buffer";
+    m_pDevice->CreateBuffer( BuffDesc, nullptr, &mGridCellCountsBuffer );
+    BuffDesc.Name = "Grid cell offsets buffer";
+    m_pDevice->CreateBuffer( BuffDesc, nullptr, &mGridCellOffsetsBuffer );
+
+    BuffDesc.ElementByteStride = sizeof(float4);
+    BuffDesc.Size              = sizeof(float4) * numCells;
+    BuffDesc.Name = "Grid cell centers buffer";
+    m_pDevice->CreateBuffer( BuffDesc, nullptr, &mGridCellCentersBuffer );
+    BuffDesc.Name = "Grid cell headings buffer";
+    m_pDevice->CreateBuffer( BuffDesc, nullptr, &mGridCellHeadingsBuffer );
+
+    initUpdateParticleSRBs();
+}
+
+// Per-particle neighbor lists for binning mode 3, released in the other modes. SRBs are updated by the caller
+void ComputeParticles::initVerletBuffers()
+{
+    mNeighborListsBuffer.Release();
+    mNeighborCountsBuffer.Release();
+    mVerletPositionsBuffer.Release();
+    mVerletStateBuffer.Release();
+    mVerletDispatchArgsBuffer.Release();
+    mVerletRebuildPending = true;
+
+    if( ! mComputeShadersSupported || mBinningMode != 3 || mParticleCapacity <= 0 ) {
+        return;
+    }
+
+    BufferDesc BuffDesc;
+    BuffDesc.Usage             = USAGE_DEFAULT;
+    BuffDesc.BindFlags         = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+    BuffDesc.Mode              = BUFFER_MODE_STRUCTURED;
+    BuffDesc.ImmediateContextMask = mSimContextMask;
+
+    BuffDesc.Name              = "Neighbor lists buffer";
+    BuffDesc.ElementByteStride = sizeof(int);
+    BuffDesc.Size              = Uint64( sizeof(int) ) * mVerletMaxNeighbors * mParticleCapacity;
+    m_pDevice->CreateBuffer( BuffDesc, nullptr, &mNeighborListsBuffer );
+    BuffDesc.Name              = "Neighbor counts buffer";
+    BuffDesc.Size              = Uint64( sizeof(int) ) * mParticleCapacity;
+    m_pDevice->CreateBuffer( BuffDesc, nullptr, &mNeighborCountsBuffer );
+    BuffDesc.Name              = "Verlet positions buffer";
+    BuffDesc.ElementByteStride = sizeof(float4);
+    BuffDesc.Size              = Uint64( sizeof(float4) ) * mParticleCapacity;
+    m_pDevice->CreateBuffer( BuffDesc, nullptr, &mVerletPositionsBuffer );
+
+    // zero initialized, the check pass resets the max displacement each step
+    const Uint32 initialState[VerletStateSize / sizeof(Uint32)] = {};
+    BufferData stateData{ initialState, sizeof(initialState) };
+    BuffDesc.Name              = "Verlet state buffer";
+    BuffDesc.BindFlags         = BIND_UNORDERED_ACCESS;
+    BuffDesc.Mode              = BUFFER_MODE_RAW;
+    BuffDesc.ElementByteStride = sizeof(Uint32);
+    BuffDesc.Size              = VerletStateSize;
+    m_pDevice->CreateBuffer( BuffDesc, &stateData, &mVerletStateBuffer );
+
+    BuffDesc.Name              = "Verlet dispatch args buffer";
+    BuffDesc.BindFlags         = BIND_INDIRECT_DRAW_ARGS | BIND_UNORDERED_ACCESS;
+    BuffDesc.Size              = VerletDispatchArgsStride * 3;
+    m_pDevice->CreateBuffer( BuffDesc, nullptr, &mVerletDispatchArgsBuffer );
+
+    if( ! mVerletStateReadback ) {
+        mVerletStateReadback = std::make_unique<ju::ReadbackBuffer>( m_pDevice, "Verlet state", VerletStateSize, 3, mSimContextMask );
+    }
+    mVerletRebuilds = mVerletSteps = 0;
+    mVerletMaxDisplacement = 0;
+    mVerletNeighborsOverflow = 0;
+}
+
+// Sizes the grid so that a cell edge is at least the largest interaction distance, which means a particle's neighbors
+// are always within the 27 surrounding cells. Cell buffers are only reallocated when the total cell count changes.
+void ComputeParticles::updateGridSize()
+{
+    const auto &c = mParticleConstants;
+    float cellSize = std::max( { c.cohesionDist, c.alignmentDist, c.separationDist, 0.001f } );
+    // the verlet lists are gathered out to cohesionDist + skin
+    if( mBinningMode == 3 ) {
+        cellSize = std::max( cellSize, c.cohesionDist + mVerletSkin );
+    }
+    // cells further than farFieldDist are aggregated, so only the near field sizes the grid
+    if( c.farFieldDist < c.separationDist ) {
+        mParticleConstants.farFieldDist = c.separationDist;
+        mParticleConstantsDirty = true;
+    }
+    if( mBinningMode == 1 && mFarField ) {
+        cellSize = std::max( c.farFieldDist, 0.001f );
+    }
+    const float3 worldSize = c.worldMax - c.worldMin;
+
+    auto cellsForAxis = [&]( float extent ) {
+        return std::clamp( int( std::floor( extent / cellSize ) ), 1, mMaxGridCellsPerAxis );
+    };
+
+    const int3 gridSize = { cellsForAxis( worldSize.x ), cellsForAxis( worldSize.y ), cellsForAxis( worldSize.z ) };
+    const int3 prevGridSize = mParticleConstants.gridSize;
+    if( gridSize != prevGridSize ) {
+        mParticleConstants.gridSize = gridSize;
+        mParticleConstantsDirty = true;
+    }
+
+    const int numCells = gridSize.x * gridSize.y * gridSize.z;
+    const int prevNumCells = prevGridSize.x * prevGridSize.y * prevGridSize.z;
+    if( numCells != prevNumCells || ( mComputeShadersSupported && ! mGridCellCountsBuffer ) ) {
+        LOG_INFO_MESSAGE( __FUNCTION__, "| grid size: [", gridSize.x, ", ", gridSize.y, ", ", gridSize.z, "], cell size: ", cellSize, ", num cells: ", numCells );
+        initGridBuffers();
+    }
+}
+
+void ComputeParticles::initUpdateParticleSRBs()
+{
+    if( ! mParticlePositionsBuffers[1] || ! mGridCellCountsBuffer ) {
+        return;
+    }
+
+    IBufferView* forcesUAV              = mParticleForcesBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS );
+    IBufferView* forcesSRV              = mParticleForcesBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE );
+    IBufferView* particleCellsUAV       = mParticleCellsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS );
+    IBufferView* particleCellsSRV       = mParticleCellsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE );
+    IBufferView* sortedParticleIdsUAV   = mSortedParticleIdsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS );
+    IBufferView* sortedParticleIdsSRV   = mSortedParticleIdsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE );
+    IBufferView* gridCellCountsUAV      = mGridCellCountsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS );
+    IBufferView* gridCellCountsSRV      = mGridCellCountsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE );
+    IBufferView* gridCellOffsetsUAV     = mGridCellOffsetsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS );
+    IBufferView* gridCellOffsetsSRV     = mGridCellOffsetsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE );
+
+    // variables that were compiled out of a shader (ex. BINNING_MODE 0) will return null
+    auto setVar = []( IShaderResourceBinding* srb, const char* name, IDeviceObject* object ) {
+        if( auto var = srb->GetVariableByName( SHADER_TYPE_COMPUTE, name ) ) {
+            var->Set( object );
+        }
+    };
+
+    if( mResetGridCellsPSO ) {
+        mResetGridCellsSRB.Release();
+        mResetGridCellsPSO->CreateShaderResourceBinding( &mResetGridCellsSRB, true );
+        setVar( mResetGridCellsSRB, "GridCellCounts", gridCellCountsUAV );
     }
     if( mMoveParticlesPSO ) {
-        mMoveParticlesSRB.Release();
-        mMoveParticlesPSO->CreateShaderResourceBinding( &mMoveParticlesSRB, true );
-        mMoveParticlesSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "Particles" )->Set( particleAttribsBufferUAV );
-        mMoveParticlesSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "ParticleListHead" )->Set( particleListHeadsBufferUAV );
-        mMoveParticlesSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "ParticleLists" )->Set( particleListsBufferUAV );
+        for( int i = 0; i < 2; i++ ) {
+            auto &srb = mMoveParticlesSRBs[i];
+            srb.Release();
+            mMoveParticlesPSO->CreateShaderResourceBinding( &srb, true );
+            setVar( srb, "ParticlePositionsIn", mParticlePositionsBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "ParticleVelocitiesIn", mParticleVelocitiesBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "ParticlePositionsOut", mParticlePositionsBuffers[1 - i]->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "ParticleVelocitiesOut", mParticleVelocitiesBuffers[1 - i]->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "ParticleForces", forcesSRV );
+            setVar( srb, "GridCellCounts", gridCellCountsUAV );
+            setVar( srb, "ParticleCells", particleCellsUAV );
+        }
+    }
+    if( mMoveReorderParticlesPSO ) {
+        for( int i = 0; i < 2; i++ ) {
+            auto &srb = mMoveReorderParticlesSRBs[i];
+            srb.Release();
+            mMoveReorderParticlesPSO->CreateShaderResourceBinding( &srb, true );
+            setVar( srb, "ParticlePositionsIn", mParticlePositionsBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "ParticleVelocitiesIn", mParticleVelocitiesBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "ParticlePositionsOut", mParticlePositionsBuffers[1 - i]->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "ParticleVelocitiesOut", mParticleVelocitiesBuffers[1 - i]->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "ParticleForces", forcesSRV );
+            setVar( srb, "GridCellCounts", gridCellCountsUAV );
+            setVar( srb, "ParticleCells", particleCellsUAV );
+            setVar( srb, "ParticleOrder", mSortValuesBuffers[0]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        }
+    }
+    if( mPrefixSumCellsPSO ) {
+        mPrefixSumCellsSRB.Release();
+        mPrefixSumCellsPSO->CreateShaderResourceBinding( &mPrefixSumCellsSRB, true );
+        setVar( mPrefixSumCellsSRB, "GridCellCounts", gridCellCountsSRV );
+        setVar( mPrefixSumCellsSRB, "GridCellOffsets", gridCellOffsetsUAV );
+    }
+    if( mScatterParticlesPSO ) {
+        mScatterParticlesSRB.Release();
+        mScatterParticlesPSO->CreateShaderResourceBinding( &mScatterParticlesSRB, true );
+        setVar( mScatterParticlesSRB, "ParticleCells", particleCellsSRV );
+        setVar( mScatterParticlesSRB, "GridCellOffsets", gridCellOffsetsSRV );
+        setVar( mScatterParticlesSRB, "SortedParticleIds", sortedParticleIdsUAV );
+    }
+    if( mAggregateCellsPSO ) {
+        for( int i = 0; i < 2; i++ ) {
+            auto &srb = mAggregateCellsSRBs[i];
+            srb.Release();
+            mAggregateCellsPSO->CreateShaderResourceBinding( &srb, true );
+            setVar( srb, "ParticlePositions", mParticlePositionsBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "ParticleVelocities", mParticleVelocitiesBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "GridCellCounts", gridCellCountsSRV );
+            setVar( srb, "GridCellOffsets", gridCellOffsetsSRV );
+            setVar( srb, "SortedParticleIds", sortedParticleIdsSRV );
+            setVar( srb, "GridCellCenters", mGridCellCentersBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "GridCellHeadings", mGridCellHeadingsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        }
     }
     if( mInteractParticlesPSO ) {
-        mInteractParticlesSRB.Release();
-        mInteractParticlesPSO->CreateShaderResourceBinding( &mInteractParticlesSRB, true );
-        mInteractParticlesSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "Particles" )->Set( particleAttribsBufferUAV );
+        for( int i = 0; i < 2; i++ ) {
+            auto &srb = mInteractParticlesSRBs[i];
+            srb.Release();
+            mInteractParticlesPSO->CreateShaderResourceBinding( &srb, true );
+            setVar( srb, "ParticlePositions", mParticlePositionsBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "ParticleVelocities", mParticleVelocitiesBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "ParticleForces", forcesUAV );
+            if( mSdfVolume ) {
+                setVar( srb, "SdfVolume", mSdfVolume->GetDefaultView( TEXTURE_VIEW_SHADER_RESOURCE ) );
+            }
+#if DEBUG_PARTICLE_BUFFERS
+            setVar( srb, "ParticleDebug", mParticleDebugBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+#endif
+            setVar( srb, "GridCellCounts", gridCellCountsSRV );
+            setVar( srb, "GridCellOffsets", gridCellOffsetsSRV );
+            setVar( srb, "SortedParticleIds", sortedParticleIdsSRV );
+            setVar( srb, "GridCellCenters", mGridCellCentersBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "GridCellHeadings", mGridCellHeadingsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            if( mNeighborListsBuffer ) {
+                setVar( srb, "NeighborLists", mNeighborListsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+                setVar( srb, "NeighborCounts", mNeighborCountsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            }
+        }
+    }
+    if( mVerletDisplacementPSO && mVerletStateBuffer ) {
+        for( int i = 0; i < 2; i++ ) {
+            auto &srb = mVerletDisplacementSRBs[i];
+            srb.Release();
+            mVerletDisplacementPSO->CreateShaderResourceBinding( &srb, true );
+            setVar( srb, "ParticlePositions", mParticlePositionsBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "VerletPositions", mVerletPositionsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "VerletState", mVerletStateBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        }
+    }
+    if( mVerletCheckPSO && mVerletStateBuffer ) {
+        mVerletCheckSRB.Release();
+        mVerletCheckPSO->CreateShaderResourceBinding( &mVerletCheckSRB, true );
+        setVar( mVerletCheckSRB, "VerletState", mVerletStateBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        setVar( mVerletCheckSRB, "VerletDispatchArgs", mVerletDispatchArgsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+    }
+    if( mBuildVerletListsPSO && mNeighborListsBuffer ) {
+        for( int i = 0; i < 2; i++ ) {
+            auto &srb = mBuildVerletListsSRBs[i];
+            srb.Release();
+            mBuildVerletListsPSO->CreateShaderResourceBinding( &srb, true );
+            setVar( srb, "ParticlePositions", mParticlePositionsBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "GridCellCounts", gridCellCountsSRV );
+            setVar( srb, "GridCellOffsets", gridCellOffsetsSRV );
+            setVar( srb, "SortedParticleIds", sortedParticleIdsSRV );
+            setVar( srb, "NeighborLists", mNeighborListsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "NeighborCounts", mNeighborCountsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "VerletPositions", mVerletPositionsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "VerletState", mVerletStateBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        }
+    }
+    if( mBakeSdfPSO && mSdfVolume ) {
+        mBakeSdfSRB.Release();
+        mBakeSdfPSO->CreateShaderResourceBinding( &mBakeSdfSRB, true );
+        setVar( mBakeSdfSRB, "SdfVolume", mSdfVolume->GetDefaultView( TEXTURE_VIEW_UNORDERED_ACCESS ) );
+    }
+    if( mMortonKeysPSO ) {
+        for( int i = 0; i < 2; i++ ) {
+            auto &srb = mMortonKeysSRBs[i];
+            srb.Release();
+            mMortonKeysPSO->CreateShaderResourceBinding( &srb, true );
+            setVar( srb, "ParticlePositions", mParticlePositionsBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "SortKeys", mSortKeysBuffers[0]->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "SortValues", mSortValuesBuffers[0]->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        }
+    }
+    if( mRadixSortCountPSO ) {
+        for( int i = 0; i < 2; i++ ) {
+            auto &srb = mRadixSortCountSRBs[i];
+            srb.Release();
+            mRadixSortCountPSO->CreateShaderResourceBinding( &srb, true );
+            setVar( srb, "KeysIn", mSortKeysBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "BlockDigitCounts", mBlockDigitCountsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        }
+    }
+    if( mRadixSortScanPSO ) {
+        mRadixSortScanSRB.Release();
+        mRadixSortScanPSO->CreateShaderResourceBinding( &mRadixSortScanSRB, true );
+        setVar( mRadixSortScanSRB, "BlockDigitCounts", mBlockDigitCountsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        setVar( mRadixSortScanSRB, "BlockDigitOffsets", mBlockDigitOffsetsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+    }
+    if( mCullParticlesPSO && mDrawArgsBuffer ) {
+        for( int i = 0; i < 2; i++ ) {
+            auto &srb = mCullParticlesSRBs[i];
+            srb.Release();
+            mCullParticlesPSO->CreateShaderResourceBinding( &srb, true );
+            setVar( srb, "ParticlePositions", mParticlePositionsBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "ParticlePositionsPrev", mParticlePositionsBuffers[1 - i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "ParticleVelocities", mParticleVelocitiesBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "VisibleParticleIds", mVisibleParticleIdsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "ParticleTransforms", mParticleTransformsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "DrawArgs", mDrawArgsBuffer->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        }
+    }
+    if( mRadixSortScatterPSO ) {
+        for( int i = 0; i < 2; i++ ) {
+            auto &srb = mRadixSortScatterSRBs[i];
+            srb.Release();
+            mRadixSortScatterPSO->CreateShaderResourceBinding( &srb, true );
+            setVar( srb, "KeysIn", mSortKeysBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "ValuesIn", mSortValuesBuffers[i]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "BlockDigitOffsets", mBlockDigitOffsetsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+            setVar( srb, "KeysOut", mSortKeysBuffers[1 - i]->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+            setVar( srb, "ValuesOut", mSortValuesBuffers[1 - i]->GetDefaultView( BUFFER_VIEW_UNORDERED_ACCESS ) );
+        }
+    }
+}
+
+// Picks the fastest thread group size for each simulation kernel. Every candidate is timed with a duration query around only that
+// kernel's dispatches, once per step over several steps, while the other kernels keep their current size. The median step
+// decides. The result is cached per device so this only runs on the first launch.
+void ComputeParticles::tuneThreadGroupSizes( bool useCache )
+{
+    if( ! mComputeShadersSupported || mSimulationBackend != SimulationBackend::Gpu ) {
+        return;
+    }
 
-        auto listHead =  mInteractParticlesSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "ParticleListHead" );
-        if( listHead ) {
-            listHead->Set( particleListHeadsBufferSRV );
+    const int numParticles = mParticleConstants.numParticles;
+    const std::string deviceKey = GetDeviceCacheKey( m_pDevice );
+    if( useCache && LoadThreadGroupSizes( deviceKey, mKernelGroupSizes, NumParticleKernels ) ) {
+        LOG_INFO_MESSAGE( __FUNCTION__, "| using cached thread group sizes for ", deviceKey );
+        fitThreadGroupSizes( numParticles );
+        initUpdateParticlePSO();
+        initParticleBuffers();
+        return;
+    }
+
+    if( m_pDevice->GetDeviceInfo().Features.DurationQueries == DEVICE_FEATURE_STATE_DISABLED ) {
+        LOG_WARNING_MESSAGE( __FUNCTION__, "| duration queries not supported, keeping the default thread group sizes" );
+        return;
+    }
+
+    mKernelTimingQuery.Release();
+    QueryDesc queryDesc;
+    queryDesc.Name = "Thread group size tuning query";
+    queryDesc.Type = QUERY_TYPE_DURATION;
+    m_pDevice->CreateQuery( queryDesc, &mKernelTimingQuery );
+    if( ! mKernelTimingQuery ) {
+        return;
+    }
+
+    // every candidate starts from the same particles, returns the median seconds the kernel took per step or -1 if the kernels
+    // failed to compile
+    auto timeKernel = [&]( ParticleKernel kernel ) -> double {
+        const bool reorder = kernel == KernelSortParticles;
+        const bool sortAvailable = mMortonKeysPSO && mRadixSortCountPSO && mRadixSortScanPSO && mRadixSortScatterPSO && mMoveReorderParticlesPSO;
+        if( ! mResetGridCellsPSO || ! mMoveParticlesPSO || ! mPrefixSumCellsPSO || ! mScatterParticlesPSO || ! mInteractParticlesPSO || ( reorder && ! sortAvailable ) ) {
+            return -1;
         }
-        auto lists = mInteractParticlesSRB->GetVariableByName( SHADER_TYPE_COMPUTE, "ParticleLists" );
-        if( lists ) {
-            lists->Set( particleListsBufferSRV );
+
+        initParticleBuffers();
+        for( int step = 0; step < ThreadGroupTuningWarmupSteps; step++ ) {
+            updateParticlesGpu( reorder );
         }
+
+        std::vector<double> samples;
+        mTimedKernel = kernel;
+        for( int step = 0; step < ThreadGroupTuningSteps; step++ ) {
+            // otherwise the verlet lists mode only scans and scatters on the steps that rebuild
+            mVerletRebuildPending = true;
+            updateParticlesGpu( reorder );
+            mSimContext->WaitForIdle();
+
+            QueryDataDuration data;
+            if( mKernelTimingQuery->GetData( &data, sizeof(data) ) && data.Frequency != 0 ) {
+                samples.push_back( double( data.Duration ) / double( data.Frequency ) );
+            }
+        }
+        mTimedKernel = -1;
+
+        if( samples.empty() ) {
+            return -1;
+        }
+        std::nth_element( samples.begin(), samples.begin() + samples.size() / 2, samples.end() );
+        return samples[samples.size() / 2];
+    };
+
+    // enough work to tell the sizes apart, but few enough particles that every candidate is a legal dispatch
+    mParticleConstants.numParticles = std::clamp( numParticles, ThreadGroupTuningParticles, ThreadGroupTuningMaxParticles );
+    mParticleConstantsDirty = true;
+    uploadParticleConstants();
+
+    static const char* kernelNames[NumParticleKernels] = { "reset grid cells", "move particles", "prefix sum cells", "scatter particles", "interact particles", "sort particles" };
+    for( int kernel = 0; kernel < NumParticleKernels; kernel++ ) {
+        // the grid kernels only run with the uniform grid and verlet list binning modes
+        const bool gridKernel = kernel == KernelResetGridCells || kernel == KernelPrefixSumCells || kernel == KernelScatterParticles;
+        if( gridKernel && mBinningMode != 1 && mBinningMode != 3 ) {
+            continue;
+        }
+
+        const int initialSize = mKernelGroupSizes[kernel];
+        int bestSize = initialSize;
+        double bestSeconds = std::numeric_limits<double>::max();
+        for( int groupSize : ThreadGroupSizeCandidates ) {
+            mKernelGroupSizes[kernel] = groupSize;
+            initUpdateParticlePSO();
+            const double seconds = timeKernel( ParticleKernel( kernel ) );
+            LOG_INFO_MESSAGE( __FUNCTION__, "| ", kernelNames[kernel], ", group size: ", groupSize, ", median ms: ", seconds * 1000.0 );
+            if( seconds > 0 && seconds < bestSeconds ) {
+                bestSeconds = seconds;
+                bestSize = groupSize;
+            }
+        }
+        mKernelGroupSizes[kernel] = bestSize;
     }
+    mKernelTimingQuery.Release();
+
+    SaveThreadGroupSizes( deviceKey, mKernelGroupSizes, NumParticleKernels );
+    LOG_INFO_MESSAGE( __FUNCTION__, "| tuned thread group sizes for ", deviceKey, " saved to ", ThreadGroupSizesCachePath );
+
+    mParticleConstants.numParticles = numParticles;
+    mParticleConstantsDirty = true;
+    fitThreadGroupSizes( numParticles );
+    initUpdateParticlePSO();
+    initParticleBuffers();
+}
+
+// Raises any kernel's thread group size that is too small to dispatch numParticles threads (see FitsDispatchLimit()) to the
+// next candidate that fits. Returns true if a size changed, the PSOs then need to be rebuilt.
+bool ComputeParticles::fitThreadGroupSizes( int numParticles )
+{
+    bool changed = false;
+    for( int &groupSize : mKernelGroupSizes ) {
+        for( int candidate : ThreadGroupSizeCandidates ) {
+            if( candidate > groupSize && ! FitsDispatchLimit( numParticles, groupSize ) ) {
+                LOG_INFO_MESSAGE( __FUNCTION__, "| thread group size ", groupSize, " can't dispatch ", numParticles, " particles, using ", candidate );
+                groupSize = candidate;
+                changed = true;
+            }
+        }
+    }
+    return changed;
 }
 
 void ComputeParticles::initConsantBuffers()
@@ -573,9 +1758,66 @@ void ComputeParticles::initConsantBuffers()
         BuffDesc.Usage          = USAGE_DEFAULT;
         //BuffDesc.CPUAccessFlags = CPU_ACCESS_WRITE;
         BuffDesc.Size           = sizeof(ParticleConstants);
+        BuffDesc.ImmediateContextMask = mSimContextMask; // bound to the compute PSOs, which may run on either context
         m_pDevice->CreateBuffer( BuffDesc, nullptr, &mParticleConstantsBuffer );
     }
 
+    // RadixSortConstants, updated before each sort pass
+    {
+        BufferDesc BuffDesc;
+        BuffDesc.Name           = "RadixSortConstants buffer";
+        BuffDesc.BindFlags      = BIND_UNIFORM_BUFFER;
+        BuffDesc.Usage          = USAGE_DEFAULT;
+        BuffDesc.Size           = sizeof(RadixSortConstants);
+        BuffDesc.ImmediateContextMask = mSimContextMask;
+        m_pDevice->CreateBuffer( BuffDesc, nullptr, &mRadixSortConstantsBuffer );
+    }
+
+    // ParticleInitConstants, updated when the particle buffers are initialized
+    {
+        BufferDesc BuffDesc;
+        BuffDesc.Name           = "ParticleInitConstants buffer";
+        BuffDesc.BindFlags      = BIND_UNIFORM_BUFFER;
+        BuffDesc.Usage          = USAGE_DEFAULT;
+        BuffDesc.Size           = sizeof(ParticleInitConstants);
+        BuffDesc.ImmediateContextMask = mSimContextMask;
+        m_pDevice->CreateBuffer( BuffDesc, nullptr, &mParticleInitConstantsBuffer );
+    }
+
+    // VerletConstants, updated before the verlet passes each step
+    {
+        BufferDesc BuffDesc;
+        BuffDesc.Name           = "VerletConstants buffer";
+        BuffDesc.BindFlags      = BIND_UNIFORM_BUFFER;
+        BuffDesc.Usage          = USAGE_DEFAULT;
+        BuffDesc.Size           = sizeof(VerletConstants);
+        BuffDesc.ImmediateContextMask = mSimContextMask;
+        m_pDevice->CreateBuffer( BuffDesc, nullptr, &mVerletConstantsBuffer );
+    }
+
+    // FrustumCullConstants, updated before the cull pass each frame
+    {
+        BufferDesc BuffDesc;
+        BuffDesc.Name           = "CullConstants buffer";
+        BuffDesc.BindFlags      = BIND_UNIFORM_BUFFER;
+        BuffDesc.Usage          = USAGE_DEFAULT;
+        BuffDesc.Size           = sizeof(FrustumCullConstants);
+        BuffDesc.ImmediateContextMask = mSimContextMask;
+        m_pDevice->CreateBuffer( BuffDesc, nullptr, &mCullConstantsBuffer );
+    }
+
+    // ParticleFrameConstants, mapped with discard once per frame before drawing
+    {
+        BufferDesc BuffDesc;
+        BuffDesc.Name                 = "ParticleFrameConstants buffer";
+        BuffDesc.BindFlags            = BIND_UNIFORM_BUFFER;
+        BuffDesc.Usage                = USAGE_DYNAMIC;
+        BuffDesc.CPUAccessFlags       = CPU_ACCESS_WRITE;
+        BuffDesc.Size                 = sizeof(ParticleFrameConstants);
+        BuffDesc.ImmediateContextMask = (Uint64{1} << m_pImmediateContext->GetDesc().ContextId);
+        m_pDevice->CreateBuffer( BuffDesc, nullptr, &mParticleFrameConstantsBuffer );
+    }
+
     // PostProcessConstants
     {
         BufferDesc BuffDesc;
@@ -612,12 +1854,25 @@ void ComputeParticles::watchShadersDir()
                         // make a list of files we actually want to update if changed and check that here
                         const static std::vector<PathType> checkFilenames = {
                             "interact_particles.csh",
-                            "sdfScene.fxh",
                             "move_particles.csh",
-                            "reset_particles.csh",
+                            "reset_grid_cells.csh",
+                            "prefix_sum_cells.csh",
+                            "scatter_particles.csh",
+                            "bake_sdf.csh",
+                            "morton_keys.csh",
+                            "radix_sort_count.csh",
+                            "radix_sort_scan.csh",
+                            "radix_sort_scatter.csh",
+                            "radix_sort.fxh",
+                            "cull_particles.csh",
+                            "init_particles.csh",
+                            "verlet_displacement.csh",
+                            "verlet_check.csh",
+                            "build_verlet_lists.csh",
+                            "aggregate_cells.csh",
                             "particle_sprite.vsh",
                             "particle_sprite.psh",
-                            "particle.fxh",
+                            "particles.fxh",
                             "structures.fxh"
                         };
 
@@ -639,6 +1894,31 @@ void ComputeParticles::watchShadersDir()
         }
     }
 
+    // sdf scene, shared with the background canvas. Reloading the particle shaders also re-bakes the sdf volume
+    {
+        std::filesystem::path shaderDir( "shaders/canvas" );
+
+        if( std::filesystem::exists( shaderDir ) ) {
+            LOG_INFO_MESSAGE( __FUNCTION__, "| watching assets directory: ", shaderDir );
+            try {
+                ShadersDirWatchHandle3 = std::make_unique<FileWatchType>( shaderDir.string(),
+                    [=](const PathType &path, const filewatch::Event change_type ) {
+                        if( path == PathType( "sdfScene.fxh" ) ) {
+                            LOG_INFO_MESSAGE( __FUNCTION__, "| \t- file event type: ", watchEventTypeToString( change_type ) , ", path: " , path );
+                            ParticleShaderAssetsMarkedDirty = true;
+                        }
+                    }
+                );
+            }
+            catch( std::system_error &exc ) {
+                LOG_ERROR_MESSAGE( __FUNCTION__, "| exception caught attempting to watch directory (assets): ", shaderDir, ", what: ", exc.what() );
+            }
+        }
+        else {
+            LOG_WARNING_MESSAGE( __FUNCTION__, "| shader directory couldn't be found (not watching): ", shaderDir );
+        }
+    }
+
     // post
     {
         std::filesystem::path shaderDir( "shaders/post" );
@@ -653,6 +1933,7 @@ void ComputeParticles::watchShadersDir()
                         const static std::vector<PathType> checkFilenames = {
                             "post_process.vsh",
                             "post_process.psh",
+                            "downsample.csh",
                         };
 
                         for( const auto &p : checkFilenames ) {
@@ -690,6 +1971,9 @@ void ComputeParticles::checkReloadOnAssetsUpdated()
         LOG_INFO_MESSAGE( __FUNCTION__, "| re-initializing Post Process shader assets" );
 
         initPostProcessPSO();
+        if( mDownsampler ) {
+            mDownsampler->reloadShaders();
+        }
 
         PostShaderAssetsMarkedDirty = false;
     }
@@ -730,21 +2014,17 @@ void ComputeParticles::WindowResize( Uint32 Width, Uint32 Height )
 	    RTDesc.Width = Width;
 	    RTDesc.Height = Height;
 	    RTDesc.MipLevels = DownSampleFactor;
-	    RTDesc.BindFlags = BIND_RENDER_TARGET | BIND_SHADER_RESOURCE;
+	    RTDesc.BindFlags = BIND_RENDER_TARGET | BIND_SHADER_RESOURCE | ( mDownsampler ? BIND_UNORDERED_ACCESS : BIND_NONE );
 	    RTDesc.Format = global()->colorBufferFormat;
 	    m_pDevice->CreateTexture( RTDesc, nullptr, &m_GBuffer.Color );
 
 	    // Create texture view
 	    for( Uint32 Mip = 0; Mip < DownSampleFactor; ++Mip ) {
 		    TextureViewDesc ViewDesc;
-		    ViewDesc.ViewType = TEXTURE_VIEW_RENDER_TARGET;
+		    ViewDesc.ViewType = TEXTURE_VIEW_SHADER_RESOURCE;
 		    ViewDesc.TextureDim = RESOURCE_DIM_TEX_2D;
 		    ViewDesc.MostDetailedMip = Mip;
 		    ViewDesc.NumMipLevels = 1;
-
-		    m_GBuffer.Color->CreateView( ViewDesc, &m_GBuffer.ColorRTVs[Mip] );
-
-		    ViewDesc.ViewType = TEXTURE_VIEW_SHADER_RESOURCE;
 		    m_GBuffer.Color->CreateView( ViewDesc, &m_GBuffer.ColorSRBs[Mip] );
 	    }
 
@@ -764,13 +2044,9 @@ void ComputeParticles::WindowResize( Uint32 Width, Uint32 Height )
         }
 	}
 
-	// Create down sample SRB
-	for( Uint32 Mip = 0; Mip < DownSampleFactor; ++Mip ) {
-		auto& SRB = mDownSampleSRB[Mip];
-		SRB.Release();
-		mDownSamplePSO->CreateShaderResourceBinding( &SRB );
-		SRB->GetVariableByName( SHADER_TYPE_PIXEL, "g_GBuffer_Color" )->Set( m_GBuffer.ColorSRBs[Mip] );
-	}
+    if( mDownsampler ) {
+        mDownsampler->setTexture( m_GBuffer.Color );
+    }
 
     // Create window-size offscreen render target to render post-processing into, so we can anti-alias after
     {
@@ -805,10 +2081,19 @@ void ComputeParticles::Update( double CurrTime, double ElapsedTime )
     SampleBase::Update( CurrTime, ElapsedTime );
     updateUI();
 
+    if( mBenchmark ) {
+        updateBenchmark( ElapsedTime );
+    }
+
     checkReloadOnAssetsUpdated();
+    updateGridSize();
 
     mTime = (float)CurrTime;
     mTimeDelta = (float)ElapsedTime;
+
+    // smoothed separately for async compute off / on, so toggling it compares the two
+    float &frameTimeMs = mFrameTimeMs[mAsyncCompute && mComputeContext ? 1 : 0];
+    frameTimeMs = frameTimeMs > 0 ? frameTimeMs + ( mTimeDelta * 1000.0f - frameTimeMs ) * 0.05f : mTimeDelta * 1000.0f;
     mCamera.Update( m_InputController, mTimeDelta );
 
     // Build a transform matrix for the test solid
@@ -822,201 +2107,636 @@ void ComputeParticles::Update( double CurrTime, double ElapsedTime )
         auto rot = GetRotationQuat( float3( 0, 1, 0 ), TestSolidLookAt, float3( 0, 1, 0 ) );
         modelTransform *= rot.ToMatrix();
     }
-    else {
-        modelTransform *= TestSolidRotation.ToMatrix();
+    else {
+        modelTransform *= TestSolidRotation.ToMatrix();
+    }
+
+    modelTransform *= float4x4::Translation( TestSolidTranslate );
+
+    if( mBackgroundCanvas ) {
+        mBackgroundCanvas->update( ElapsedTime );
+    }
+
+    if( mTestSolid ) {
+        mTestSolid->setLightDir( LightDir );
+        mTestSolid->update( ElapsedTime );
+        mTestSolid->setTransform( modelTransform );
+    }
+    if( mParticleSolid ) {
+        mParticleSolid->setLightDir( LightDir );
+        mParticleSolid->update( ElapsedTime );
+        //mParticleSolid->setTransform( modelTransform );
+    }
+
+    if( UseFirstPersonCamera ) {
+        mViewProjMatrix = mCamera.GetViewMatrix() * mCamera.GetProjMatrix();
+        //mWorldViewProjMatrix = modelTransform * mCamera.GetViewMatrix() * mCamera.GetProjMatrix();
+    }
+    else {
+        // from samples..
+        // 
+        // Camera is at (0, 0, -5) looking along the Z axis
+        float4x4 View = float4x4::Translation(0.f, 0.0f, 5.0f);
+
+        // Get pretransform matrix that rotates the scene according the surface orientation
+        // TODO: remove to simplify for now, this is the identity matrix on desktop
+        auto SrfPreTransform = GetSurfacePretransformMatrix(float3{0, 0, 1});
+
+        // Get projection matrix adjusted to the current screen orientation
+        //auto Proj = GetAdjustedProjectionMatrix(PI_F / 4.0f, 0.1f, 100.f);
+        auto Proj = GetAdjustedProjectionMatrix( mCamera.GetProjAttribs().FOV, mCamera.GetProjAttribs().NearClipPlane, mCamera.GetProjAttribs().FarClipPlane );
+
+        mViewProjMatrix = View * SrfPreTransform * Proj;
+        //mWorldViewProjMatrix = modelTransform * View * SrfPreTransform * Proj;
+    }
+}
+
+// Render a frame
+void ComputeParticles::Render()
+{
+    const float gray = 0.00f;
+    const float ClearColor[] = { gray, gray, gray, 0.0f}; // alpha channel is for glow intensity
+
+    //auto* rtv = m_pSwapChain->GetCurrentBackBufferRTV();
+    //auto* dsv = m_pSwapChain->GetDepthBufferDSV();
+    
+    // Render to GBuffer
+	ITextureView* rtv = m_GBuffer.Color->GetDefaultView( TEXTURE_VIEW_RENDER_TARGET );
+	ITextureView* dsv = m_GBuffer.Depth->GetDefaultView( TEXTURE_VIEW_DEPTH_STENCIL );
+	m_pImmediateContext->SetRenderTargets( 1, &rtv, dsv, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+    // TODO: tut23 says "transitions is not needed" - why not?
+    // - uses RESOURCE_STATE_TRANSITION_MODE_VERIFY instead
+    m_pImmediateContext->ClearRenderTarget( rtv, ClearColor, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    m_pImmediateContext->ClearDepthStencil( dsv, CLEAR_DEPTH_FLAG, 1.0f, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+    // validation and the CPU backend read particle buffers back on the immediate context, so those always run in sync
+    const bool asyncCompute = mAsyncCompute && mComputeContext && mSimulationBackend == SimulationBackend::Gpu && ! mValidateCpuSimulation;
+    waitForAsyncSimulation();
+    uploadParticleConstants();
+    if( mBinningMode == 3 ) {
+        growVerletLists();
+    }
+
+    if( ! asyncCompute ) {
+        mSimContext = m_pImmediateContext;
+        updateParticles();
+    }
+
+    {
+        MapHelper<ParticleFrameConstants> frameConstants( m_pImmediateContext, mParticleFrameConstantsBuffer, MAP_WRITE, MAP_FLAG_DISCARD );
+        frameConstants->viewProj = mViewProjMatrix.Transpose();
+        frameConstants->time = float( mSimulationClock.getSimulationTime() );
+        // draw between the last two simulation states, so motion is smooth regardless of how many steps ran this frame
+        frameConstants->interpolationAlpha = mInterpolateParticles && mPrevParticleStateValid ? float( mSimulationClock.getAlpha() ) : 1.0f;
+    }
+    drawParticles();
+
+    if( mTestSolid && mDrawTestSolid ) {
+        mTestSolid->draw( m_pImmediateContext, mViewProjMatrix );
+    }
+
+    if( asyncCompute ) {
+        // the particle buffers aren't read for the rest of the frame, so the next frame's simulation
+        // runs on the compute queue while the background and post-processing are rendered
+        m_pImmediateContext->EnqueueSignal( mGraphicsFence, ++mGraphicsFenceValue );
+        m_pImmediateContext->Flush();
+
+        mSimContext = mComputeContext;
+        mComputeContext->DeviceWaitForFence( mGraphicsFence, mGraphicsFenceValue );
+        updateParticles();
+        mComputeContext->EnqueueSignal( mComputeFence, ++mComputeFenceValue );
+        mComputeContext->Flush();
+        mSimContext = m_pImmediateContext;
+    }
+
+    // draw background as late as possible as it is raymarching and writing to SV_DEPTH, which breaks early z testing
+    drawBackgroundCanvas();
+
+    if( mPostProcessConstants.glowEnabled && mDownsampler ) {
+        downSample();
+    }
+
+    // Final pass
+    ITextureView *mainRenderTarget = m_pSwapChain->GetCurrentBackBufferRTV();
+    if( mFXAAEnabled ) {
+        // TODO: render to a new target and then pass its TextureView into FXAA apply
+        // - code below needs to be called from FXAA->preDraw() or something
+        // - can depth buffer view be null?
+        
+        // Clear the offscreen render target and depth buffer
+        const float clearColor[] = { 0.0f, 0.05f, 0.4f, 1.0f };
+        m_pImmediateContext->SetRenderTargets( 1, &mPostProcessRTV, nullptr, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        m_pImmediateContext->ClearRenderTarget( mPostProcessRTV, clearColor, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        //m_pImmediateContext->ClearDepthStencil(m_pDepthDSV, CLEAR_DEPTH_FLAG, 1.0f, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+
+        postProcess();
+
+        // bind the main render target and render AA into main target
+        m_pImmediateContext->SetRenderTargets( 1, &mainRenderTarget, nullptr, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+        JU_PROFILE( "FXAA", m_pImmediateContext, mProfiler.get() );
+        mFXAA->apply( m_pImmediateContext, m_GBuffer.Color->GetDefaultView( TEXTURE_VIEW_SHADER_RESOURCE ) );
+    }
+    else {
+        m_pImmediateContext->SetRenderTargets( 1, &mainRenderTarget, nullptr, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        postProcess();
+    }
+}
+
+// Uploads mParticleConstants when something changed since the last upload. Must be called while no simulation is in flight,
+// the compute queue reads the same buffer.
+void ComputeParticles::uploadParticleConstants()
+{
+    // the simulation always steps by the clock's fixed step
+    const float deltaTime = float( mSimulationClock.getFixedStep() );
+    if( mParticleConstants.deltaTime != deltaTime ) {
+        mParticleConstants.deltaTime = deltaTime;
+        mParticleConstantsDirty = true;
+    }
+
+    if( ! mParticleConstantsDirty ) {
+        return;
+    }
+
+    m_pImmediateContext->UpdateBuffer( mParticleConstantsBuffer, 0, sizeof( mParticleConstants ), &mParticleConstants, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    mParticleConstantsDirty = false;
+}
+
+void ComputeParticles::updateParticles()
+{
+    if( mUpdateParticles ) {
+        // run as many fixed steps as real time (scaled by speed) has accumulated, 0 on some frames when rendering faster than the step rate
+        // benchmarks step exactly once per frame, so timings don't depend on how many steps the frame rate calls for
+        const int numSteps = mSimulationClock.advance( mBenchmark ? mSimulationClock.getFixedStep() : mTimeDelta * mSimulationSpeed );
+        for( int step = 0; step < numSteps; step++ ) {
+            if( mSimulationBackend == SimulationBackend::Cpu ) {
+                updateParticlesCpu();
+            }
+            else if( mValidateCpuSimulation ) {
+                validateCpuSimulation();
+                mValidateCpuSimulation = false;
+            }
+            else {
+                bool reorder = false;
+                if( mReorderInterval > 0 && ++mStepsSinceReorder >= mReorderInterval ) {
+                    reorder = true;
+                    mStepsSinceReorder = 0;
+                }
+                updateParticlesGpu( reorder );
+            }
+        }
+
+        if( mSimulationBackend == SimulationBackend::Gpu && mBinningMode == 3 ) {
+            readVerletState( numSteps > 0 );
+        }
+    }
+
+#if DEBUG_PARTICLE_BUFFERS
+    if( mDebugCopyParticles ) {
+        // copy the requested range into the readback rings, results are consumed a couple frames later without stalling
+        mDebugParticlesCount = std::clamp( mDebugParticlesCount, 1, std::min( MaxDebugParticles, mParticleConstants.numParticles ) );
+        mDebugParticlesStart = std::clamp( mDebugParticlesStart, 0, mParticleConstants.numParticles - mDebugParticlesCount );
+        const size_t start = size_t( mDebugParticlesStart );
+        const size_t count = size_t( mDebugParticlesCount );
+
+        mParticlePositionsReadback->enqueue( mSimContext, mParticlePositionsBuffers[mParticleStateIndex], start * sizeof(float4), count * sizeof(float4) );
+        mParticleVelocitiesReadback->enqueue( mSimContext, mParticleVelocitiesBuffers[mParticleStateIndex], start * sizeof(float4), count * sizeof(float4) );
+        mParticleForcesReadback->enqueue( mSimContext, mParticleForcesBuffer, start * sizeof(float4), count * sizeof(float4) );
+        if( mParticleDebugBuffer ) {
+            mParticleDebugReadback->enqueue( mSimContext, mParticleDebugBuffer, start * sizeof(ParticleDebugAttribs), count * sizeof(ParticleDebugAttribs) );
+        }
+        if( mParticleCellsBuffer && mSortedParticleIdsBuffer ) {
+            mParticleCellsReadback->enqueue( mSimContext, mParticleCellsBuffer, start * sizeof(int2), count * sizeof(int2) );
+            mSortedParticleIdsReadback->enqueue( mSimContext, mSortedParticleIdsBuffer, start * sizeof(int), count * sizeof(int) );
+        }
+
+        auto consumeReadback = [this]( ju::ReadbackBuffer *readback, auto &result, int *resultStart ) {
+            using T = typename std::remove_reference_t<decltype(result)>::value_type;
+            readback->consume( mSimContext, [&result, resultStart]( const void *data, size_t size, size_t sourceOffset ) {
+                result.resize( size / sizeof(T) );
+                std::memcpy( result.data(), data, result.size() * sizeof(T) );
+                if( resultStart ) {
+                    *resultStart = int( sourceOffset / sizeof(T) );
+                }
+            } );
+        };
+        consumeReadback( mParticlePositionsReadback.get(), DebugParticleStateData.positions, &DebugParticleAttribsStart );
+        consumeReadback( mParticleVelocitiesReadback.get(), DebugParticleStateData.velocities, nullptr );
+        consumeReadback( mParticleForcesReadback.get(), DebugParticleStateData.forces, nullptr );
+        consumeReadback( mParticleDebugReadback.get(), DebugParticleAttribsData, nullptr );
+        consumeReadback( mParticleCellsReadback.get(), DebugParticleCellsData, &DebugParticleGridStart );
+        consumeReadback( mSortedParticleIdsReadback.get(), DebugSortedParticleIdsData, nullptr );
+    }
+#endif
+
+    //mProfiler->end( m_pImmediateContext, "update particles" );
+}
+
+// Makes the graphics queue wait for the last simulation submitted to the compute queue, before it next touches the particle buffers
+void ComputeParticles::waitForAsyncSimulation()
+{
+    if( mComputeFence && mComputeFenceValue > 0 ) {
+        m_pImmediateContext->DeviceWaitForFence( mComputeFence, mComputeFenceValue );
+    }
+}
+
+void ComputeParticles::updateParticlesGpu( bool reorder )
+{
+    if( ! mResetGridCellsPSO || ! mMoveParticlesPSO || ! mPrefixSumCellsPSO || ! mScatterParticlesPSO || ! mInteractParticlesPSO ) {
+        return;
+    }
+
+    // the move pass gathers particles through the sorted order, so the rest of the frame sees them in Morton order
+    if( reorder ) {
+        ScopedKernelQuery kernelQuery( mSimContext, getKernelTimingQuery( KernelSortParticles ) );
+        reorder = sortParticlesByMortonCode();
+    }
+
+    const int3 &gridSize = mParticleConstants.gridSize;
+    const Uint32 numCells = Uint32( gridSize.x * gridSize.y * gridSize.z );
+    const bool useVerletLists = mBinningMode == 3 && mVerletCheckPSO && mVerletCheckSRB && mBuildVerletListsSRBs[0];
+    const bool useGrid = mBinningMode == 1 || useVerletLists;
+
+    // each kernel has its own thread group size (see tuneThreadGroupSizes())
+    auto dispatchAttribsFor = [this]( ParticleKernel kernel, Uint32 numThreads ) {
+        const Uint32 groupSize = Uint32( mKernelGroupSizes[kernel] );
+        return DispatchComputeAttribs{ ( numThreads + groupSize - 1 ) / groupSize, 1, 1 };
+    };
+    const Uint32 numParticles = Uint32( mParticleConstants.numParticles );
+
+    if( useGrid ) {
+        JU_PROFILE( "reset grid cells", mSimContext, mProfiler.get() );
+        ScopedKernelQuery kernelQuery( mSimContext, getKernelTimingQuery( KernelResetGridCells ) );
+        const DispatchComputeAttribs cellDispatchAttribs = dispatchAttribsFor( KernelResetGridCells, numCells );
+
+        mSimContext->SetPipelineState( mResetGridCellsPSO );
+        mSimContext->CommitShaderResources( mResetGridCellsSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        mSimContext->DispatchCompute( cellDispatchAttribs );
+    }
+
+    {
+        // reads the current state and writes the other buffer, which becomes current for the rest of the frame
+        JU_PROFILE( "move particles", mSimContext, mProfiler.get() );
+        ScopedKernelQuery kernelQuery( mSimContext, getKernelTimingQuery( KernelMoveParticles ) );
+        if( reorder ) {
+            mSimContext->SetPipelineState( mMoveReorderParticlesPSO );
+            mSimContext->CommitShaderResources( mMoveReorderParticlesSRBs[mParticleStateIndex], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        }
+        else {
+            mSimContext->SetPipelineState( mMoveParticlesPSO );
+            mSimContext->CommitShaderResources( mMoveParticlesSRBs[mParticleStateIndex], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        }
+        mSimContext->DispatchCompute( dispatchAttribsFor( KernelMoveParticles, numParticles ) );
+        mParticleStateIndex = 1 - mParticleStateIndex;
+        // the other buffer now holds the previous step, unless it was in a different order
+        mPrevParticleStateValid = ! reorder;
+    }
+
+    if( useVerletLists ) {
+        // the lists were built from particle ids in the old order
+        if( reorder ) {
+            mVerletRebuildPending = true;
+        }
+        updateVerletLists();
+    }
+    else if( useGrid ) {
+        {
+            JU_PROFILE( "prefix sum cells", mSimContext, mProfiler.get() );
+            ScopedKernelQuery kernelQuery( mSimContext, getKernelTimingQuery( KernelPrefixSumCells ) );
+            mSimContext->SetPipelineState( mPrefixSumCellsPSO );
+            mSimContext->CommitShaderResources( mPrefixSumCellsSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+            mSimContext->DispatchCompute( DispatchComputeAttribs{ 1, 1, 1 } );
+        }
+        {
+            JU_PROFILE( "scatter particles", mSimContext, mProfiler.get() );
+            ScopedKernelQuery kernelQuery( mSimContext, getKernelTimingQuery( KernelScatterParticles ) );
+            mSimContext->SetPipelineState( mScatterParticlesPSO );
+            mSimContext->CommitShaderResources( mScatterParticlesSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+            mSimContext->DispatchCompute( dispatchAttribsFor( KernelScatterParticles, numParticles ) );
+        }
+        if( mAggregateCellsPSO ) {
+            JU_PROFILE( "aggregate cells", mSimContext, mProfiler.get() );
+            const Uint32 groupSize = Uint32( mThreadGroupSize );
+            mSimContext->SetPipelineState( mAggregateCellsPSO );
+            mSimContext->CommitShaderResources( mAggregateCellsSRBs[mParticleStateIndex], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+            mSimContext->DispatchCompute( DispatchComputeAttribs{ ( numCells + groupSize - 1 ) / groupSize, 1, 1 } );
+        }
+    }
+
+    if( mUseSdfVolume && mAvoidSdf ) {
+        bakeSdfVolume();
+    }
+
+    {
+        JU_PROFILE( "interact particles", mSimContext, mProfiler.get() );
+        ScopedKernelQuery kernelQuery( mSimContext, getKernelTimingQuery( KernelInteractParticles ) );
+        mSimContext->SetPipelineState( mInteractParticlesPSO );
+        mSimContext->CommitShaderResources( mInteractParticlesSRBs[mParticleStateIndex], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        mSimContext->DispatchCompute( dispatchAttribsFor( KernelInteractParticles, numParticles ) );
     }
+}
 
-    modelTransform *= float4x4::Translation( TestSolidTranslate );
+// Binning mode 3: the grid was counted by the move pass, but it's only scanned, scattered and turned into neighbor lists
+// once some particle moved more than half the skin since the last build (or a rebuild was requested from the CPU).
+// That decision stays on the GPU, the rebuild passes are dispatched indirectly with zero groups when it isn't needed.
+void ComputeParticles::updateVerletLists()
+{
+    const Uint32 numParticles = Uint32( mParticleConstants.numParticles );
+    const Uint32 groupSize = Uint32( mThreadGroupSize );
 
-    if( mBackgroundCanvas ) {
-        mBackgroundCanvas->update( ElapsedTime );
+    VerletConstants verletConstants;
+    verletConstants.skin         = mVerletSkin;
+    verletConstants.forceRebuild = mVerletRebuildPending ? 1 : 0;
+    mSimContext->UpdateBuffer( mVerletConstantsBuffer, 0, sizeof(verletConstants), &verletConstants, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    mVerletRebuildPending = false;
+
+    {
+        JU_PROFILE( "verlet displacement", mSimContext, mProfiler.get() );
+        mSimContext->SetPipelineState( mVerletDisplacementPSO );
+        mSimContext->CommitShaderResources( mVerletDisplacementSRBs[mParticleStateIndex], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        mSimContext->DispatchCompute( DispatchComputeAttribs{ ( numParticles + groupSize - 1 ) / groupSize, 1, 1 } );
+    }
+    {
+        JU_PROFILE( "verlet check", mSimContext, mProfiler.get() );
+        mSimContext->SetPipelineState( mVerletCheckPSO );
+        mSimContext->CommitShaderResources( mVerletCheckSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        mSimContext->DispatchCompute( DispatchComputeAttribs{ 1, 1, 1 } );
     }
 
-    if( mTestSolid ) {
-        mTestSolid->setLightDir( LightDir );
-        mTestSolid->update( ElapsedTime );
-        mTestSolid->setTransform( modelTransform );
+    DispatchComputeIndirectAttribs indirectAttribs;
+    indirectAttribs.pAttribsBuffer = mVerletDispatchArgsBuffer;
+    indirectAttribs.AttribsBufferStateTransitionMode = RESOURCE_STATE_TRANSITION_MODE_TRANSITION;
+    {
+        JU_PROFILE( "prefix sum cells", mSimContext, mProfiler.get() );
+        ScopedKernelQuery kernelQuery( mSimContext, getKernelTimingQuery( KernelPrefixSumCells ) );
+        mSimContext->SetPipelineState( mPrefixSumCellsPSO );
+        mSimContext->CommitShaderResources( mPrefixSumCellsSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        indirectAttribs.DispatchArgsByteOffset = 0;
+        mSimContext->DispatchComputeIndirect( indirectAttribs );
     }
-    if( mParticleSolid ) {
-        mParticleSolid->setLightDir( LightDir );
-        mParticleSolid->update( ElapsedTime );
-        //mParticleSolid->setTransform( modelTransform );
+    {
+        JU_PROFILE( "scatter particles", mSimContext, mProfiler.get() );
+        ScopedKernelQuery kernelQuery( mSimContext, getKernelTimingQuery( KernelScatterParticles ) );
+        mSimContext->SetPipelineState( mScatterParticlesPSO );
+        mSimContext->CommitShaderResources( mScatterParticlesSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        indirectAttribs.DispatchArgsByteOffset = VerletDispatchArgsStride;
+        mSimContext->DispatchComputeIndirect( indirectAttribs );
+    }
+    {
+        JU_PROFILE( "build verlet lists", mSimContext, mProfiler.get() );
+        mSimContext->SetPipelineState( mBuildVerletListsPSO );
+        mSimContext->CommitShaderResources( mBuildVerletListsSRBs[mParticleStateIndex], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        indirectAttribs.DispatchArgsByteOffset = VerletDispatchArgsStride * 2;
+        mSimContext->DispatchComputeIndirect( indirectAttribs );
     }
+}
 
-    if( UseFirstPersonCamera ) {
-        mViewProjMatrix = mCamera.GetViewMatrix() * mCamera.GetProjMatrix();
-        //mWorldViewProjMatrix = modelTransform * mCamera.GetViewMatrix() * mCamera.GetProjMatrix();
+// Rebuild stats for the settings window and the neighbor overflow for growVerletLists(). Enqueued once per frame rather than
+// per step, so any number of substeps fits in the ring. The overflow is only cleared when the lists are recreated, so the
+// last step's value covers every build before it.
+void ComputeParticles::readVerletState( bool stepped )
+{
+    if( ! mVerletStateReadback || ! mVerletStateBuffer ) {
+        return;
+    }
+
+    if( stepped && ! mVerletStateReadback->enqueue( mSimContext, mVerletStateBuffer, 0, VerletStateSize ) ) {
+        // all slots are in flight, the next frame's readback includes this one's builds
+        LOG_WARNING_MESSAGE( __FUNCTION__, "| verlet state readback ring is full" );
+    }
+    mVerletStateReadback->consume( mSimContext, [this]( const void *data, size_t, size_t ) {
+        const Uint32 *state = static_cast<const Uint32 *>( data );
+        mVerletRebuilds = state[1];
+        mVerletSteps = state[2];
+        std::memcpy( &mVerletMaxDisplacement, &state[3], sizeof(float) );
+        mVerletNeighborsOverflow = std::max( mVerletNeighborsOverflow, int( state[4] ) );
+    } );
+}
+
+// Some particle had more neighbors than fit in its list during a recent build, so the lists are reallocated with room
+// for that many plus some headroom. Called while no simulation is in flight, since the buffers and PSOs are recreated.
+void ComputeParticles::growVerletLists()
+{
+    if( mVerletNeighborsOverflow <= mVerletMaxNeighbors || mVerletMaxNeighbors >= VerletNeighborsLimit ) {
+        return;
+    }
+
+    const int numNeighbors = std::min( ( mVerletNeighborsOverflow * 5 / 4 + 15 ) / 16 * 16, VerletNeighborsLimit );
+    if( numNeighbors < mVerletNeighborsOverflow ) {
+        LOG_WARNING_MESSAGE( __FUNCTION__, "| particles have up to ", mVerletNeighborsOverflow, " neighbors, only the nearest ", numNeighbors, " are kept" );
     }
     else {
-        // from samples..
-        // 
-        // Camera is at (0, 0, -5) looking along the Z axis
-        float4x4 View = float4x4::Translation(0.f, 0.0f, 5.0f);
+        LOG_INFO_MESSAGE( __FUNCTION__, "| particles have up to ", mVerletNeighborsOverflow, " neighbors, growing the lists to ", numNeighbors );
+    }
 
-        // Get pretransform matrix that rotates the scene according the surface orientation
-        // TODO: remove to simplify for now, this is the identity matrix on desktop
-        auto SrfPreTransform = GetSurfacePretransformMatrix(float3{0, 0, 1});
+    mVerletMaxNeighbors = numNeighbors;
+    initVerletBuffers();
+    initUpdateParticlePSO();
+}
 
-        // Get projection matrix adjusted to the current screen orientation
-        //auto Proj = GetAdjustedProjectionMatrix(PI_F / 4.0f, 0.1f, 100.f);
-        auto Proj = GetAdjustedProjectionMatrix( mCamera.GetProjAttribs().FOV, mCamera.GetProjAttribs().NearClipPlane, mCamera.GetProjAttribs().FarClipPlane );
+// The sdf scene is static, so it's baked into a 3D texture once instead of sphere tracing sdf_scene() per particle each frame
+void ComputeParticles::initSdfVolume()
+{
+    mSdfVolume.Release();
+    mSdfVolumeDirty = true;
 
-        mViewProjMatrix = View * SrfPreTransform * Proj;
-        //mWorldViewProjMatrix = modelTransform * View * SrfPreTransform * Proj;
+    if( ! mComputeShadersSupported ) {
+        return;
     }
+
+    TextureDesc texDesc;
+    texDesc.Name      = "SDF volume";
+    texDesc.Type      = RESOURCE_DIM_TEX_3D;
+    texDesc.Width     = Uint32( mSdfVolumeResolution );
+    texDesc.Height    = Uint32( mSdfVolumeResolution );
+    texDesc.Depth     = Uint32( mSdfVolumeResolution );
+    texDesc.MipLevels = 1;
+    texDesc.Format    = TEX_FORMAT_RGBA16_FLOAT;
+    texDesc.BindFlags = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+    texDesc.ImmediateContextMask = mSimContextMask;
+    m_pDevice->CreateTexture( texDesc, nullptr, &mSdfVolume );
+
+    initUpdateParticleSRBs();
 }
 
-// Render a frame
-void ComputeParticles::Render()
+// Re-bakes only when the shaders were reloaded or the world bounds changed
+void ComputeParticles::bakeSdfVolume()
 {
-    const float gray = 0.00f;
-    const float ClearColor[] = { gray, gray, gray, 0.0f}; // alpha channel is for glow intensity
+    const auto &c = mParticleConstants;
+    if( c.worldMin != mSdfVolumeWorldMin || c.worldMax != mSdfVolumeWorldMax ) {
+        mSdfVolumeDirty = true;
+    }
 
-    //auto* rtv = m_pSwapChain->GetCurrentBackBufferRTV();
-    //auto* dsv = m_pSwapChain->GetDepthBufferDSV();
-    
-    // Render to GBuffer
-	ITextureView* rtv = m_GBuffer.Color->GetDefaultView( TEXTURE_VIEW_RENDER_TARGET );
-	ITextureView* dsv = m_GBuffer.Depth->GetDefaultView( TEXTURE_VIEW_DEPTH_STENCIL );
-	m_pImmediateContext->SetRenderTargets( 1, &rtv, dsv, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    if( ! mSdfVolumeDirty || ! mBakeSdfPSO || ! mBakeSdfSRB ) {
+        return;
+    }
 
-    // TODO: tut23 says "transitions is not needed" - why not?
-    // - uses RESOURCE_STATE_TRANSITION_MODE_VERIFY instead
-    m_pImmediateContext->ClearRenderTarget( rtv, ClearColor, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
-    m_pImmediateContext->ClearDepthStencil( dsv, CLEAR_DEPTH_FLAG, 1.0f, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    JU_PROFILE( "bake sdf", mSimContext, mProfiler.get() );
 
-    // Update mParticleConstantsBuffer
-    mParticleConstants.viewProj = mViewProjMatrix.Transpose();
-    mParticleConstants.deltaTime     = std::min( mTimeDelta, 1.f / 60.f) * mSimulationSpeed;
-    mParticleConstants.time = mTime;
-    m_pImmediateContext->UpdateBuffer( mParticleConstantsBuffer, 0, sizeof( mParticleConstants ), &mParticleConstants, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    const Uint32 groupSize = 4; // SDF_VOLUME_GROUP_SIZE in bake_sdf.csh
+    const Uint32 numGroups = ( Uint32( mSdfVolumeResolution ) + groupSize - 1 ) / groupSize;
 
+    mSimContext->SetPipelineState( mBakeSdfPSO );
+    mSimContext->CommitShaderResources( mBakeSdfSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    mSimContext->DispatchCompute( DispatchComputeAttribs{ numGroups, numGroups, numGroups } );
 
-    updateParticles();
-    drawParticles();
+    mSdfVolumeWorldMin = c.worldMin;
+    mSdfVolumeWorldMax = c.worldMax;
+    mSdfVolumeDirty = false;
+}
 
-    if( mTestSolid && mDrawTestSolid ) {
-        mTestSolid->draw( m_pImmediateContext, mViewProjMatrix );
+// Sorts the current particle ids by the Morton code of their grid cell, leaving the sorted order in mSortValuesBuffers[0].
+// Returns false if the sort passes aren't available.
+bool ComputeParticles::sortParticlesByMortonCode()
+{
+    if( ! mMortonKeysPSO || ! mRadixSortCountPSO || ! mRadixSortScanPSO || ! mRadixSortScatterPSO || ! mMoveReorderParticlesPSO || ! mMortonKeysSRBs[mParticleStateIndex] ) {
+        return false;
     }
 
-    // draw background as late as possible as it is raymarching and writing to SV_DEPTH, which breaks early z testing
-    drawBackgroundCanvas();
+    JU_PROFILE( "reorder particles", mSimContext, mProfiler.get() );
 
-    if( mPostProcessConstants.glowEnabled ) {
-        downSample();
+    const int numParticles = mParticleConstants.numParticles;
+    const int groupSize = mKernelGroupSizes[KernelSortParticles];
+    const int numBlocks = ( numParticles + groupSize - 1 ) / groupSize;
+
+    // only sort the key bits that can be set for the current grid, rounded up to an even number of passes so the result ends up in buffer 0
+    const int3 &gridSize = mParticleConstants.gridSize;
+    const int maxCellsPerAxis = std::max( { gridSize.x, gridSize.y, gridSize.z } );
+    int bitsPerAxis = 1;
+    while( ( 1 << bitsPerAxis ) < maxCellsPerAxis ) {
+        bitsPerAxis++;
+    }
+    int numPasses = ( 3 * bitsPerAxis + RadixSortBits - 1 ) / RadixSortBits;
+    numPasses += numPasses % 2;
+
+    DispatchComputeAttribs dispatchAttribs;
+    dispatchAttribs.ThreadGroupCountX = Uint32( numBlocks );
+
+    mSimContext->SetPipelineState( mMortonKeysPSO );
+    mSimContext->CommitShaderResources( mMortonKeysSRBs[mParticleStateIndex], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    mSimContext->DispatchCompute( dispatchAttribs );
+
+    for( int pass = 0; pass < numPasses; pass++ ) {
+        const int src = pass % 2;
+        RadixSortConstants sortConstants;
+        sortConstants.numKeys   = numParticles;
+        sortConstants.numBlocks = numBlocks;
+        sortConstants.bitShift  = pass * RadixSortBits;
+        mSimContext->UpdateBuffer( mRadixSortConstantsBuffer, 0, sizeof(sortConstants), &sortConstants, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+        mSimContext->SetPipelineState( mRadixSortCountPSO );
+        mSimContext->CommitShaderResources( mRadixSortCountSRBs[src], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        mSimContext->DispatchCompute( dispatchAttribs );
+
+        mSimContext->SetPipelineState( mRadixSortScanPSO );
+        mSimContext->CommitShaderResources( mRadixSortScanSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        mSimContext->DispatchCompute( DispatchComputeAttribs{ 1, 1, 1 } );
+
+        mSimContext->SetPipelineState( mRadixSortScatterPSO );
+        mSimContext->CommitShaderResources( mRadixSortScatterSRBs[src], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+        mSimContext->DispatchCompute( dispatchAttribs );
     }
 
-    // Final pass
-    ITextureView *mainRenderTarget = m_pSwapChain->GetCurrentBackBufferRTV();
-    if( mFXAAEnabled ) {
-        // TODO: render to a new target and then pass its TextureView into FXAA apply
-        // - code below needs to be called from FXAA->preDraw() or something
-        // - can depth buffer view be null?
-        
-        // Clear the offscreen render target and depth buffer
-        const float clearColor[] = { 0.0f, 0.05f, 0.4f, 1.0f };
-        m_pImmediateContext->SetRenderTargets( 1, &mPostProcessRTV, nullptr, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
-        m_pImmediateContext->ClearRenderTarget( mPostProcessRTV, clearColor, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
-        //m_pImmediateContext->ClearDepthStencil(m_pDepthDSV, CLEAR_DEPTH_FLAG, 1.0f, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    return true;
+}
 
-        postProcess();
+// Steps the CPU simulation and uploads the result, rendering reads the particle buffer the same as with the GPU update
+void ComputeParticles::updateParticlesCpu()
+{
+    if( ! mParticleSimCpu ) {
+        return;
+    }
 
-        // bind the main render target and render AA into main target
-        m_pImmediateContext->SetRenderTargets( 1, &mainRenderTarget, nullptr, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    auto options = mParticleSimCpu->getOptions();
+    // the CPU simulation has no verlet lists, the uniform grid finds the same neighbors
+    options.binningMode = mBinningMode == 3 ? 1 : mBinningMode;
+    options.avoidSdf = mAvoidSdf;
+    mParticleSimCpu->setOptions( options );
 
-        JU_PROFILE( "FXAA", m_pImmediateContext, mProfiler.get() );
-        mFXAA->apply( m_pImmediateContext, m_GBuffer.Color->GetDefaultView( TEXTURE_VIEW_SHADER_RESOURCE ) );
-    }
-    else {
-        m_pImmediateContext->SetRenderTargets( 1, &mainRenderTarget, nullptr, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
-        postProcess();
+    mParticleSimCpu->step( getCpuSimConstants() );
+
+    JU_PROFILE( "upload particles", mSimContext, mProfiler.get() );
+    const Uint32 streamSize = Uint32( mParticleSimCpu->getNumParticles() * sizeof(cpusim::float4) );
+    mSimContext->UpdateBuffer( mParticlePositionsBuffers[mParticleStateIndex], 0, streamSize, mParticleSimCpu->getPositions().data(), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    mSimContext->UpdateBuffer( mParticleVelocitiesBuffers[mParticleStateIndex], 0, streamSize, mParticleSimCpu->getVelocities().data(), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    mSimContext->UpdateBuffer( mParticleForcesBuffer, 0, streamSize, mParticleSimCpu->getForces().data(), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    mPrevParticleStateValid = false; // updated in place, there's no previous state to interpolate from
+#if DEBUG_PARTICLE_BUFFERS
+    if( mDebugCopyParticles && mParticleDebugBuffer ) {
+        const auto &debugAttribs = mParticleSimCpu->getDebugAttribs();
+        mSimContext->UpdateBuffer( mParticleDebugBuffer, 0, Uint32( debugAttribs.size() * sizeof(cpusim::ParticleDebugAttribs) ), debugAttribs.data(), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
     }
+#endif
 }
 
-void ComputeParticles::updateParticles()
+void ComputeParticles::setSimulationBackend( SimulationBackend backend )
 {
-    if( ! mResetParticleListsPSO || ! mMoveParticlesPSO || ! mInteractParticlesPSO ) {
+    if( backend == mSimulationBackend ) {
         return;
     }
 
-    if( mUpdateParticles ) {
-        DispatchComputeAttribs dispatchAttribs;
-        dispatchAttribs.ThreadGroupCountX = ( mParticleConstants.numParticles + mThreadGroupSize - 1) / mThreadGroupSize;
-
-        {
-            JU_PROFILE( "reset particles", m_pImmediateContext, mProfiler.get() );
-            m_pImmediateContext->SetPipelineState( mResetParticleListsPSO );
-            m_pImmediateContext->CommitShaderResources( mResetParticleListsSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
-            m_pImmediateContext->DispatchCompute( dispatchAttribs );
+    if( backend == SimulationBackend::Cpu ) {
+        if( ! mParticleSimCpu ) {
+            mParticleSimCpu = std::make_unique<cpusim::ParticleSimCpu>();
         }
 
-        {
-            JU_PROFILE( "move particles", m_pImmediateContext, mProfiler.get() );
-            m_pImmediateContext->SetPipelineState( mMoveParticlesPSO );
-            m_pImmediateContext->CommitShaderResources( mMoveParticlesSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
-            m_pImmediateContext->DispatchCompute( dispatchAttribs );
-        }
+        // continue from the current GPU state
+        waitForAsyncSimulation();
+        ParticleStateData particles;
+        ReadParticleStateBlocking( m_pDevice, m_pImmediateContext, mParticlePositionsBuffers[mParticleStateIndex], mParticleVelocitiesBuffers[mParticleStateIndex], mParticleForcesBuffer, mParticleConstants.numParticles, particles );
+        mParticleSimCpu->setParticles( particles.cpuSimStreams(), mParticleConstants.numParticles );
+    }
+    else if( ! mComputeShadersSupported ) {
+        return;
+    }
 
-        {
-            JU_PROFILE( "interact particles", m_pImmediateContext, mProfiler.get() );
-            m_pImmediateContext->SetPipelineState( mInteractParticlesPSO );
-            m_pImmediateContext->CommitShaderResources( mInteractParticlesSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
-            m_pImmediateContext->DispatchCompute( dispatchAttribs );
-        }
+    // switching to the GPU needs nothing, the particle buffer already holds the last CPU step
+    mSimulationBackend = backend;
+}
+
+// Runs one GPU update and one CPU update from the same starting state and compares the results
+void ComputeParticles::validateCpuSimulation()
+{
+    ParticleStateData before, after;
+    ReadParticleStateBlocking( m_pDevice, m_pImmediateContext, mParticlePositionsBuffers[mParticleStateIndex], mParticleVelocitiesBuffers[mParticleStateIndex], mParticleForcesBuffer, mParticleConstants.numParticles, before );
+    updateParticlesGpu( false ); // reordering would change particle ids
+    ReadParticleStateBlocking( m_pDevice, m_pImmediateContext, mParticlePositionsBuffers[mParticleStateIndex], mParticleVelocitiesBuffers[mParticleStateIndex], mParticleForcesBuffer, mParticleConstants.numParticles, after );
+
+    if( ! mParticleSimCpu ) {
+        mParticleSimCpu = std::make_unique<cpusim::ParticleSimCpu>();
     }
+    auto options = mParticleSimCpu->getOptions();
+    options.binningMode = mBinningMode == 3 ? 1 : mBinningMode;
+    options.avoidSdf = mAvoidSdf;
+    mParticleSimCpu->setOptions( options );
+    mParticleSimCpu->setParticles( before.cpuSimStreams(), mParticleConstants.numParticles );
+    mParticleSimCpu->step( getCpuSimConstants() );
 
-#if DEBUG_PARTICLE_BUFFERS
-    if( mDebugCopyParticles ) {
-        m_pImmediateContext->CopyBuffer( mParticleAttribsBuffer, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION,
-            mParticleAttribsStaging, 0, mParticleConstants.numParticles * sizeof(ParticleAttribs), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
-        m_pImmediateContext->CopyBuffer( mParticleListsBuffer, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION,
-            mParticleListsStaging, 0, mParticleConstants.numParticles * sizeof(int), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
-        m_pImmediateContext->CopyBuffer( mParticleListHeadsBuffer, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION,
-            mParticleListsHeadStaging, 0, mParticleConstants.numParticles * sizeof(int), RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
-
-        // We should use synchronizations to safely access the mapped memory.
-        // TODO: fix and re-enable this, but not crucial when looking at debug data
-        //m_pImmediateContext->EnqueueSignal( mFenceParticleAttribsAvailable, mFenceParticleAttribsValue++ );
-        //m_pImmediateContext->Flush(); // TODO: needed?
-
-        //// TODO: check if this causes the main loop to wait
-        //m_pImmediateContext->DeviceWaitForFence( mFenceParticleAttribsAvailable, mFenceParticleAttribsValue );
-
-        // TODO: copy with std::copy or memcopy
-        DebugParticleAttribsData.resize( mParticleConstants.numParticles );
-        {
-            MapHelper<ParticleAttribs> stagingData( m_pImmediateContext, mParticleAttribsStaging, MAP_READ, MAP_FLAG_DO_NOT_WAIT );
-            if( stagingData ) {
-                for( size_t i = 0; i < mParticleConstants.numParticles; i++ ) {
-                    const ParticleAttribs &p = stagingData[i];
-                    DebugParticleAttribsData.at( i ) = p; 
-                }
-            }
-        }
-        DebugParticleListsData.resize( mParticleConstants.numParticles );
-        {
-            MapHelper<int> stagingData( m_pImmediateContext, mParticleListsStaging, MAP_READ, MAP_FLAG_DO_NOT_WAIT );
-            if( stagingData ) {
-                for( size_t i = 0; i < mParticleConstants.numParticles; i++ ) {
-                    const int &p = stagingData[i];
-                    DebugParticleListsData.at( i ) = p; 
-                }
-            }
-        }
-        DebugParticleListsHeadData.resize( mParticleConstants.numParticles );
-        {
-            MapHelper<int> stagingData( m_pImmediateContext, mParticleListsHeadStaging, MAP_READ, MAP_FLAG_DO_NOT_WAIT );
-            if( stagingData ) {
-                for( size_t i = 0; i < mParticleConstants.numParticles; i++ ) {
-                    const int &p = stagingData[i];
-                    DebugParticleListsHeadData.at( i ) = p; 
-                }
-            }
-        }
+    mCpuValidationResult = cpusim::compareParticles( after.cpuSimStreams(), mParticleSimCpu->getParticles(), mParticleConstants.numParticles, CpuValidationTolerance );
+
+    if( mUseSdfVolume ) {
+        LOG_WARNING_MESSAGE( __FUNCTION__, "| the CPU simulation uses the analytic sdf scene, expect accel differences near the scene with 'baked sdf' enabled" );
     }
-#endif
 
-    //mProfiler->end( m_pImmediateContext, "update particles" );
+    const auto &r = mCpuValidationResult;
+    LOG_INFO_MESSAGE( __FUNCTION__, "| mismatched: ", r.numMismatched, " / ", r.numCompared, ", max pos error: ", r.maxPosError,
+        ", max vel error: ", r.maxVelError, ", max accel error: ", r.maxAccelError );
+    if( r.numMismatched > 0 ) {
+        const auto &gpu = after.positions[r.firstMismatch];
+        const auto &cpu = mParticleSimCpu->getPositions()[r.firstMismatch];
+        LOG_WARNING_MESSAGE( __FUNCTION__, "| first mismatch, particle ", r.firstMismatch,
+            ", gpu pos: [", gpu.x, ", ", gpu.y, ", ", gpu.z, "], cpu pos: [", cpu.x, ", ", cpu.y, ", ", cpu.z, "]" );
+    }
+}
+
+cpusim::ParticleConstants ComputeParticles::getCpuSimConstants() const
+{
+    static_assert( sizeof(ParticleConstants) == sizeof(cpusim::ParticleConstants), "CPU simulation must use the same layout as the GPU constants" );
+
+    cpusim::ParticleConstants result;
+    std::memcpy( &result, &mParticleConstants, sizeof(result) );
+    return result;
 }
 
 void ComputeParticles::drawParticles()
@@ -1025,20 +2745,89 @@ void ComputeParticles::drawParticles()
         return;
     }
 
+    // instance counts come from the cull pass when it ran, otherwise VisibleParticleIds still holds every particle in order
+    const bool indirect = cullParticles();
+
     JU_PROFILE( "draw particles", m_pImmediateContext, mProfiler.get() );
 
     m_pImmediateContext->SetPipelineState( mRenderParticlePSO );
-    m_pImmediateContext->CommitShaderResources( mRenderParticleSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    m_pImmediateContext->CommitShaderResources( mRenderParticleSRBs[mParticleStateIndex], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
 
     if( mParticleType == ParticleType::Sprite ) {
-        DrawAttribs drawAttrs;
-        drawAttrs.NumVertices  = 4;
-        drawAttrs.NumInstances = static_cast<Uint32>( mParticleConstants.numParticles );
-        m_pImmediateContext->Draw(drawAttrs);
+        if( indirect ) {
+            DrawIndirectAttribs drawAttrs;
+            drawAttrs.pAttribsBuffer = mDrawArgsBuffer;
+            drawAttrs.AttribsBufferStateTransitionMode = RESOURCE_STATE_TRANSITION_MODE_TRANSITION;
+            m_pImmediateContext->DrawIndirect( drawAttrs );
+        }
+        else {
+            DrawAttribs drawAttrs;
+            drawAttrs.NumVertices  = 4;
+            drawAttrs.NumInstances = static_cast<Uint32>( mParticleConstants.numParticles );
+            m_pImmediateContext->Draw(drawAttrs);
+        }
     }
     else {
-        mParticleSolid->draw( m_pImmediateContext, mViewProjMatrix, mParticleConstants.numParticles );
+        mParticleSolid->setShaderResourceVar( SHADER_TYPE_VERTEX, "ParticlePositions", mParticlePositionsBuffers[mParticleStateIndex]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        mParticleSolid->setShaderResourceVar( SHADER_TYPE_VERTEX, "ParticleVelocities", mParticleVelocitiesBuffers[mParticleStateIndex]->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        IBuffer* prevPositions = mParticlePositionsBuffers[1 - mParticleStateIndex] ? mParticlePositionsBuffers[1 - mParticleStateIndex] : mParticlePositionsBuffers[mParticleStateIndex];
+        mParticleSolid->setShaderResourceVar( SHADER_TYPE_VERTEX, "ParticlePositionsPrev", prevPositions->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        mParticleSolid->setShaderResourceVar( SHADER_TYPE_VERTEX, "ParticleForces", mParticleForcesBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        mParticleSolid->setShaderResourceVar( SHADER_TYPE_VERTEX, "VisibleParticleIds", mVisibleParticleIdsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        if( mParticleTransformsBuffer ) {
+            mParticleSolid->setShaderResourceVar( SHADER_TYPE_VERTEX, "ParticleTransforms", mParticleTransformsBuffer->GetDefaultView( BUFFER_VIEW_SHADER_RESOURCE ) );
+        }
+        if( indirect ) {
+            mParticleSolid->drawIndirect( m_pImmediateContext, mViewProjMatrix, mDrawArgsBuffer );
+        }
+        else {
+            mParticleSolid->draw( m_pImmediateContext, mViewProjMatrix, mParticleConstants.numParticles );
+        }
+    }
+}
+
+// Tests particles against the camera frustum and compacts the visible ones into VisibleParticleIds, with the count in mDrawArgsBuffer.
+// Returns false if the pass isn't available, in which case all particles should be drawn directly.
+bool ComputeParticles::cullParticles()
+{
+    if( ! mCullParticlesPSO || ! mCullParticlesSRBs[mParticleStateIndex] ) {
+        return false;
+    }
+
+    JU_PROFILE( "cull particles", m_pImmediateContext, mProfiler.get() );
+
+    FrustumCullConstants cullConstants;
+    ViewFrustum frustum;
+    ExtractViewFrustumPlanesFromMatrix( mViewProjMatrix, frustum, m_pDevice->GetDeviceInfo().IsGLDevice() );
+    for( int i = 0; i < ViewFrustum::NUM_PLANES; i++ ) {
+        const Plane3D &plane = frustum.GetPlane( ViewFrustum::PLANE_IDX( i ) );
+        const float invLength = 1.0f / length( plane.Normal );
+        cullConstants.frustumPlanes[i] = float4( plane.Normal * invLength, plane.Distance * invLength );
     }
+    cullConstants.radiusScale = CullRadiusScale;
+    cullConstants.enabled = mCullParticles ? 1 : 0;
+    cullConstants.writeTransforms = mParticleType != ParticleType::Sprite ? 1 : 0;
+    m_pImmediateContext->UpdateBuffer( mCullConstantsBuffer, 0, sizeof(cullConstants), &cullConstants, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+    // NumInstances is reset here and counted up by the cull pass
+    const Uint32 vertexCount = mParticleType == ParticleType::Sprite ? 4 : mParticleSolid->getNumIndices();
+    const Uint32 drawArgs[NumDrawArgs] = { vertexCount, 0, 0, 0, 0 };
+    m_pImmediateContext->UpdateBuffer( mDrawArgsBuffer, 0, sizeof(drawArgs), drawArgs, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+
+    DispatchComputeAttribs dispatchAttribs;
+    dispatchAttribs.ThreadGroupCountX = ( mParticleConstants.numParticles + mThreadGroupSize - 1) / mThreadGroupSize;
+
+    m_pImmediateContext->SetPipelineState( mCullParticlesPSO );
+    m_pImmediateContext->CommitShaderResources( mCullParticlesSRBs[mParticleStateIndex], RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    m_pImmediateContext->DispatchCompute( dispatchAttribs );
+
+    // visible count for the UI, lags a couple frames behind
+    mDrawArgsReadback->enqueue( m_pImmediateContext, mDrawArgsBuffer, 0, sizeof(drawArgs) );
+    mDrawArgsReadback->consume( m_pImmediateContext, [this]( const void *data, size_t, size_t ) {
+        mNumVisibleParticles = static_cast<const Uint32*>( data )[1];
+    } );
+
+    return true;
 }
 
 void ComputeParticles::drawBackgroundCanvas()
@@ -1048,23 +2837,56 @@ void ComputeParticles::drawBackgroundCanvas()
     }
 
     float4x4 cameraViewProj = mCamera.GetViewMatrix() * mCamera.GetProjMatrix();
-    auto pixelConstants = mBackgroundCanvas->getPixelConstantsBuffer();
-    MapHelper<BackgroundPixelConstants> cb( m_pImmediateContext, pixelConstants, MAP_WRITE, MAP_FLAG_DISCARD );
-    cb->viewProj = cameraViewProj.Transpose();
-    cb->inverseViewProj = cameraViewProj.Inverse().Transpose();
-    cb->camPos = mCamera.GetPos();
-    cb->camDir = mCamera.GetWorldAhead();
-    cb->lightDir = LightDir;
-    cb->fogColor = mPostProcessConstants.fogColor;
-
-    auto swapChainDesc = m_pSwapChain->GetDesc();
-    cb->resolution = float2( swapChainDesc.Width, swapChainDesc.Height );
-    cb->worldMin = mParticleConstants.worldMin;
-    cb->worldMax = mParticleConstants.worldMax;
-
-    JU_PROFILE( "BackgroundCanvas", m_pImmediateContext, mProfiler.get() );
-
-    mBackgroundCanvas->render( m_pImmediateContext, mViewProjMatrix );
+    float4x4 cameraInverseViewProj = cameraViewProj.Inverse();
+
+    // only camera motion can be reprojected, cached shading is stale when anything else the shader reads has changed
+    auto &history = mBackgroundHistory;
+    if( ! history.valid || history.lightDir != LightDir || history.fogColor != mPostProcessConstants.fogColor
+            || history.worldMin != mParticleConstants.worldMin || history.worldMax != mParticleConstants.worldMax
+            || history.showIterations != mBackgroundShowIterations ) {
+        mBackgroundCanvas->invalidateHistory();
+        history.viewProj        = cameraViewProj;
+        history.inverseViewProj = cameraInverseViewProj;
+        history.camPos          = mCamera.GetPos();
+    }
+
+    {
+        BackgroundPixelConstants cb = {}; // zeroed paddings, the canvas hashes all of it
+        cb.viewProj = cameraViewProj.Transpose();
+        cb.inverseViewProj = cameraInverseViewProj.Transpose();
+        cb.camPos = mCamera.GetPos();
+        cb.camDir = mCamera.GetWorldAhead();
+        cb.lightDir = LightDir;
+        cb.fogColor = mPostProcessConstants.fogColor;
+
+        auto swapChainDesc = m_pSwapChain->GetDesc();
+        cb.resolution = float2( swapChainDesc.Width, swapChainDesc.Height );
+        cb.worldMin = mParticleConstants.worldMin;
+        cb.worldMax = mParticleConstants.worldMax;
+
+        cb.prevViewProj = history.viewProj.Transpose();
+        cb.prevInverseViewProj = history.inverseViewProj.Transpose();
+        cb.prevCamPos = history.camPos;
+        cb.showIterations = mBackgroundShowIterations ? 1 : 0;
+
+        // the canvas only marches again when these differ from the last frame's
+        mBackgroundCanvas->setPixelConstants( &cb, sizeof( cb ) );
+    }
+
+    history.viewProj        = cameraViewProj;
+    history.inverseViewProj = cameraInverseViewProj;
+    history.camPos          = mCamera.GetPos();
+    history.lightDir        = LightDir;
+    history.fogColor        = mPostProcessConstants.fogColor;
+    history.worldMin        = mParticleConstants.worldMin;
+    history.worldMax        = mParticleConstants.worldMax;
+    history.showIterations  = mBackgroundShowIterations;
+    history.valid           = true;
+
+    const int resolutionScale = mBackgroundCanvas->getResolutionScale();
+    JU_PROFILE( resolutionScale > 1 ? "BackgroundCanvas 1/" + std::to_string( resolutionScale ) : "BackgroundCanvas", m_pImmediateContext, mProfiler.get() );
+
+    mBackgroundCanvas->render( m_pImmediateContext, mViewProjMatrix, m_GBuffer.Color->GetDefaultView( TEXTURE_VIEW_RENDER_TARGET ), m_GBuffer.Depth->GetDefaultView( TEXTURE_VIEW_DEPTH_STENCIL ) );
 }
 
 // ------------------------------------------------------------------------------------------------------------
@@ -1124,53 +2946,14 @@ void ComputeParticles::initPostProcessPSO()
 
     mPostProcessPSO.Release();
     m_pDevice->CreateGraphicsPipelineState( PSOCreateInfo, &mPostProcessPSO );
-
-    // downsample buffers for glow
-    RefCntAutoPtr<IShader> downSamplePS;
-    {
-        shaderCI.Desc       = { "Down sample PS", SHADER_TYPE_PIXEL, true };
-        shaderCI.EntryPoint = "main";
-        shaderCI.FilePath   = "shaders/post/downsample.psh";
-        m_pDevice->CreateShader( shaderCI, &downSamplePS );
-    }
-    PSOCreateInfo.pPS = downSamplePS;
-
-    PSOCreateInfo.PSODesc.Name                   = "Downsample PSO";
-    PSOCreateInfo.GraphicsPipeline.RTVFormats[0] = global()->colorBufferFormat;
-
-    PSOCreateInfo.PSODesc.ResourceLayout.ImmutableSamplers    = nullptr;
-    PSOCreateInfo.PSODesc.ResourceLayout.NumImmutableSamplers = 0;
-
-    mDownSamplePSO.Release();
-    m_pDevice->CreateGraphicsPipelineState( PSOCreateInfo, &mDownSamplePSO );
 }
 
-// note: this doesn't work on D3D11 (checks in Diligent::VerifyStateTransitionDesc() fail)
+// Generates the glow mips of GBuffer.Color with two compute dispatches, a reduction and a gaussian blur (see post::Downsampler)
 void ComputeParticles::downSample()
 {
     JU_PROFILE( "downsample", m_pImmediateContext, mProfiler.get() );
 
-	m_pImmediateContext->SetPipelineState( mDownSamplePSO );
-	m_pImmediateContext->SetVertexBuffers( 0, 0, nullptr, nullptr, RESOURCE_STATE_TRANSITION_MODE_NONE, SET_VERTEX_BUFFERS_FLAG_RESET );
-	m_pImmediateContext->SetIndexBuffer( nullptr, 0, RESOURCE_STATE_TRANSITION_MODE_NONE );
-
-	StateTransitionDesc Barrier{ m_GBuffer.Color, RESOURCE_STATE_RENDER_TARGET, RESOURCE_STATE_SHADER_RESOURCE, 0u, 1u };
-
-	for( Uint32 Mip = 1; Mip < DownSampleFactor; ++Mip ) {
-		Barrier.FirstMipLevel = Mip - 1;
-		m_pImmediateContext->TransitionResourceStates( 1, &Barrier );
-
-		m_pImmediateContext->SetRenderTargets( 1, &m_GBuffer.ColorRTVs[Mip], nullptr, RESOURCE_STATE_TRANSITION_MODE_VERIFY );
-
-		m_pImmediateContext->CommitShaderResources( mDownSampleSRB[Mip - 1], RESOURCE_STATE_TRANSITION_MODE_NONE );
-		m_pImmediateContext->Draw( DrawAttribs{ 3, DRAW_FLAG_VERIFY_DRAW_ATTRIBS | DRAW_FLAG_VERIFY_STATES } );
-	}
-
-	// Transit last mipmap level to SRV state.
-	// Now all mipmaps in m_GBuffer.Color are in SRV state, so update resource state.
-	Barrier.FirstMipLevel = DownSampleFactor - 1;
-	Barrier.Flags = STATE_TRANSITION_FLAG_UPDATE_STATE;
-	m_pImmediateContext->TransitionResourceStates( 1, &Barrier );
+    mDownsampler->apply( m_pImmediateContext );
 }
 
 void ComputeParticles::postProcess()
@@ -1198,6 +2981,115 @@ void ComputeParticles::postProcess()
 // ImGui
 // ------------------------------------------------------------------------------------------------------------
 
+// Sweeps every combination of the settings below, each configuration starts from freshly spawned particles
+void ComputeParticles::startBenchmark()
+{
+    auto &bench = *mBenchmark;
+    if( ! mComputeShadersSupported ) {
+        LOG_ERROR_MESSAGE( __FUNCTION__, "| the benchmark needs compute shaders" );
+        std::exit( EXIT_FAILURE );
+    }
+
+    bench.csv.open( bench.outputPath );
+    if( ! bench.csv.is_open() ) {
+        LOG_ERROR_MESSAGE( __FUNCTION__, "| failed to open ", bench.outputPath, " for writing" );
+        std::exit( EXIT_FAILURE );
+    }
+    bench.csv << "num_particles,thread_group_size,binning_mode,avoid_sdf,pass,samples,avg_ms\n";
+
+    const int particleCounts[] = { 1000, 10000, 100000, 1000000, 10000000 };
+    const int threadGroupSizes[] = { 64, 128, 256, 512 };
+    for( int numParticles : particleCounts ) {
+        for( int threadGroupSize : threadGroupSizes ) {
+            if( ! FitsDispatchLimit( numParticles, threadGroupSize ) ) {
+                LOG_WARNING_MESSAGE( __FUNCTION__, "| skipping ", numParticles, " particles with thread group size ", threadGroupSize,
+                    ", it needs more than ", MaxDispatchGroups, " thread groups per dispatch" );
+                continue;
+            }
+            for( int binningMode = 0; binningMode < 4; binningMode++ ) {
+                // brute force is O(n^2), past this a single frame takes seconds
+                const bool bruteForce = binningMode == 0 || binningMode == 2;
+                if( bruteForce && numParticles > BenchmarkMaxBruteForceParticles ) {
+                    continue;
+                }
+                for( bool avoidSdf : { false, true } ) {
+                    bench.configs.push_back( { numParticles, threadGroupSize, binningMode, avoidSdf } );
+                }
+            }
+        }
+    }
+
+    // measure the simulation as it is by default, the UI can't change it while running unattended
+    setSimulationBackend( SimulationBackend::Gpu );
+    mValidateCpuSimulation = false;
+    mUpdateParticles = true;
+
+    LOG_INFO_MESSAGE( __FUNCTION__, "| running ", bench.configs.size(), " configurations, ", bench.warmupFrames, " warm-up and ", bench.measuredFrames, " measured frames each" );
+    applyBenchmarkConfig();
+}
+
+void ComputeParticles::applyBenchmarkConfig()
+{
+    auto &bench = *mBenchmark;
+    const auto &config = bench.configs[bench.configIndex];
+    LOG_INFO_MESSAGE( __FUNCTION__, "| (", bench.configIndex + 1, " / ", bench.configs.size(), ") particles: ", config.numParticles,
+        ", thread group size: ", config.threadGroupSize, ", binning mode: ", config.binningMode, ", avoid sdf: ", config.avoidSdf );
+
+    mThreadGroupSize = config.threadGroupSize;
+    std::fill( std::begin( mKernelGroupSizes ), std::end( mKernelGroupSizes ), config.threadGroupSize );
+    mBinningMode = config.binningMode;
+    mAvoidSdf = config.avoidSdf;
+    mParticleConstants.numParticles = config.numParticles;
+    mParticleConstantsDirty = true;
+    fitThreadGroupSizes( config.numParticles );
+    initVerletBuffers();
+    initUpdateParticlePSO();
+    initParticleBuffers();
+
+    bench.frame = 0;
+    bench.cpuFrameSeconds = 0;
+}
+
+// Averages the frame time and each profiled pass over the measured frames, then moves on to the next configuration
+void ComputeParticles::updateBenchmark( double elapsedTime )
+{
+    auto &bench = *mBenchmark;
+    bench.frame++;
+    if( bench.frame <= bench.warmupFrames ) {
+        // gpu timings lag a few frames behind, so the previous configuration's are still arriving during warm-up
+        mProfiler->resetStats();
+        return;
+    }
+
+    bench.cpuFrameSeconds += elapsedTime;
+    if( bench.frame < bench.warmupFrames + bench.measuredFrames ) {
+        return;
+    }
+
+    const auto &config = bench.configs[bench.configIndex];
+    auto writeRow = [&]( const std::string &pass, int samples, double avgSeconds ) {
+        bench.csv << config.numParticles << "," << config.threadGroupSize << "," << config.binningMode << "," << int( config.avoidSdf ) << ","
+            << pass << "," << samples << "," << avgSeconds * 1000.0 << "\n";
+    };
+    writeRow( "cpu frame", bench.measuredFrames, bench.cpuFrameSeconds / double( bench.measuredFrames ) );
+    for( const auto &[label, stats] : mProfiler->getStats() ) {
+        if( stats.numSamples > 0 ) {
+            writeRow( label, stats.numSamples, stats.totalSeconds / double( stats.numSamples ) );
+        }
+    }
+    bench.csv.flush(); // keep what's done so far if a later configuration crashes the driver
+
+    if( ++bench.configIndex < bench.configs.size() ) {
+        applyBenchmarkConfig();
+        return;
+    }
+
+    LOG_INFO_MESSAGE( __FUNCTION__, "| benchmark finished, results written to ", bench.outputPath );
+    bench.csv.close();
+    // there's no way to ask the sample app to quit, so end the process here
+    std::exit( EXIT_SUCCESS );
+}
+
 void ComputeParticles::updateUI()
 {
     if( ! mUIEnabled )
@@ -1216,20 +3108,117 @@ void ComputeParticles::updateUI()
             }
             im::SameLine();
             im::Checkbox( "draw", &mDrawParticles );
+            im::SameLine();
+            im::Checkbox( "frustum cull", &mCullParticles );
+            if( mCullParticlesPSO ) {
+                const float visiblePercent = 100.0f * float( mNumVisibleParticles ) / float( std::max( mParticleConstants.numParticles, 1 ) );
+                im::Text( "visible: %u / %d (%0.1f%%)", mNumVisibleParticles, mParticleConstants.numParticles, visiblePercent );
+            }
 
-            if( im::InputInt( "count", &mParticleConstants.numParticles, 100, 1000, ImGuiInputTextFlags_EnterReturnsTrue ) ) {
-                mParticleConstants.numParticles = std::min( std::max( mParticleConstants.numParticles, 10 ), 10000000 ); // max: 10million
-                initParticleBuffers();
-                initSolids(); // TODO: see comment for 'init particle buffers' button
+            int numParticles = mParticleConstants.numParticles;
+            if( im::InputInt( "count", &numParticles, 100, 1000, ImGuiInputTextFlags_EnterReturnsTrue ) ) {
+                resizeParticles( std::min( std::max( numParticles, 10 ), 10000000 ) ); // max: 10million
             }
+            im::SameLine();
+            im::Text( "capacity: %d", mParticleCapacity );
             im::SliderFloat( "speed", &mSimulationSpeed, 0.1f, 5.f );
-            im::DragFloat( "scale", &mParticleConstants.scale, 0.01f, 0.001f, 100.0f );
+            int stepRate = int( std::round( 1.0 / mSimulationClock.getFixedStep() ) );
+            if( im::SliderInt( "step rate (hz)", &stepRate, 15, 240 ) ) {
+                mSimulationClock.setFixedStep( 1.0 / double( stepRate ) );
+            }
+            int maxSubsteps = mSimulationClock.getMaxSubsteps();
+            if( im::SliderInt( "max substeps", &maxSubsteps, 1, 32 ) ) {
+                mSimulationClock.setMaxSubsteps( maxSubsteps );
+            }
+            im::Checkbox( "interpolate", &mInterpolateParticles );
+            im::SameLine();
+            im::Text( "substeps: %d, alpha: %0.2f, dropped: %0.2fs", mSimulationClock.getNumSubsteps(), float( mSimulationClock.getAlpha() ), float( mSimulationClock.getDroppedSeconds() ) );
+            im::BeginDisabled( ! mComputeContext );
+            im::Checkbox( "async compute", &mAsyncCompute );
+            im::EndDisabled();
+            im::SameLine();
+            im::Text( "frame time sync: %0.2fms, async: %0.2fms", mFrameTimeMs[0], mFrameTimeMs[1] );
+            mParticleConstantsDirty |= im::DragFloat( "scale", &mParticleConstants.scale, 0.01f, 0.001f, 100.0f );
             im::DragFloat( "scale variation", &mParticleScaleVariation, 0.002f, 0.0f, 100.0f );            
             im::DragFloat( "birth padding %", &mParticleBirthPadding, 0.001f, 0.0f, 1.0f );
-            im::DragFloat3( "world min", &mParticleConstants.worldMin.x, 0.01f, -1000, 1000.0f );
-            im::DragFloat3( "world max", &mParticleConstants.worldMax.x, 0.01f, -1000, 1000.0f );
+            mParticleConstantsDirty |= im::DragFloat3( "world min", &mParticleConstants.worldMin.x, 0.01f, -1000, 1000.0f );
+            mParticleConstantsDirty |= im::DragFloat3( "world max", &mParticleConstants.worldMax.x, 0.01f, -1000, 1000.0f );
+
+            static std::vector<const char*> binningModes = { "brute force", "uniform grid", "brute force (tiled)", "verlet lists" };
+            if( im::Combo( "binning", &mBinningMode, binningModes.data(), (int)binningModes.size() ) ) {
+                initVerletBuffers();
+                initUpdateParticlePSO();
+            }
+            if( mBinningMode == 3 ) {
+                if( im::DragFloat( "verlet skin", &mVerletSkin, 0.002f, 0.0f, 10.0f ) ) {
+                    mVerletRebuildPending = true;
+                }
+                im::SameLine();
+                im::Text( "rebuilds: %u / %u steps, max displacement: %0.3f, list size: %d", mVerletRebuilds, mVerletSteps, mVerletMaxDisplacement, mVerletMaxNeighbors );
+            }
+            im::Text( "grid size: [%d, %d, %d]", mParticleConstants.gridSize.x, mParticleConstants.gridSize.y, mParticleConstants.gridSize.z );
+            im::DragInt( "max cells per axis", &mMaxGridCellsPerAxis, 0.2f, 1, 1024 );
+            im::DragInt( "reorder interval", &mReorderInterval, 0.2f, 0, 1000 ); // steps between Morton order sorts, 0: off
+            const int *groupSizes = mKernelGroupSizes;
+            im::Text( "group sizes - reset: %d, move: %d, prefix sum: %d, scatter: %d, interact: %d, sort: %d",
+                groupSizes[KernelResetGridCells], groupSizes[KernelMoveParticles], groupSizes[KernelPrefixSumCells], groupSizes[KernelScatterParticles], groupSizes[KernelInteractParticles], groupSizes[KernelSortParticles] );
+            if( im::Button( "tune group sizes" ) ) {
+                tuneThreadGroupSizes( false );
+            }
+            if( mBinningMode == 1 ) {
+                if( im::Checkbox( "far field", &mFarField ) ) {
+                    initUpdateParticlePSO();
+                }
+                im::SameLine();
+                im::BeginDisabled( ! mFarField );
+                mParticleConstantsDirty |= im::DragFloat( "far field dist", &mParticleConstants.farFieldDist, 0.002f, mParticleConstants.separationDist, 100.0f );
+                im::EndDisabled();
+            }
+            if( im::Checkbox( "avoid sdf", &mAvoidSdf ) ) {
+                initUpdateParticlePSO();
+            }
+            im::SameLine();
+            if( im::Checkbox( "baked sdf", &mUseSdfVolume ) ) {
+                initUpdateParticlePSO();
+            }
+            im::SameLine();
+            im::SetNextItemWidth( 100 );
+            if( im::InputInt( "sdf resolution", &mSdfVolumeResolution, 8, 32, ImGuiInputTextFlags_EnterReturnsTrue ) ) {
+                mSdfVolumeResolution = std::clamp( mSdfVolumeResolution, 8, 256 );
+                initSdfVolume();
+            }
 
-            im::Text( "grid size: [%d, %0d, %d]", mParticleConstants.gridSize.x, mParticleConstants.gridSize.y, mParticleConstants.gridSize.y );
+            static std::vector<const char*> backends = { "gpu", "cpu" };
+            int backend = (int)mSimulationBackend;
+            im::BeginDisabled( ! mComputeShadersSupported );
+            if( im::Combo( "simulation", &backend, backends.data(), (int)backends.size() ) ) {
+                setSimulationBackend( (SimulationBackend)backend );
+            }
+            im::EndDisabled();
+            if( mSimulationBackend == SimulationBackend::Cpu && mParticleSimCpu ) {
+                const auto &t = mParticleSimCpu->getLastTimings();
+                im::Text( "cpu: %0.2fms (move: %0.2f, binning: %0.2f, interact: %0.2f)", t.total(), t.move, t.binning, t.interact );
+                auto options = mParticleSimCpu->getOptions();
+                bool simd = options.simd;
+                if( im::Checkbox( "simd", &simd ) ) {
+                    options.simd = simd;
+                    mParticleSimCpu->setOptions( options );
+                }
+                im::SameLine();
+                im::Text( "threads: %d", (int)mParticleSimCpu->getConcurrency() );
+            }
+            else if( mSimulationBackend == SimulationBackend::Gpu ) {
+                if( im::Button( "validate against cpu" ) ) {
+                    mValidateCpuSimulation = true;
+                }
+                im::SameLine();
+                im::SetNextItemWidth( 100 );
+                im::DragFloat( "tolerance", &CpuValidationTolerance, 0.0001f, 0.0f, 1.0f, "%0.4f" );
+                const auto &r = mCpuValidationResult;
+                if( r.numCompared > 0 ) {
+                    im::Text( "mismatched: %d / %d, max error pos: %0.5f, vel: %0.5f, accel: %0.5f", (int)r.numMismatched, (int)r.numCompared, r.maxPosError, r.maxVelError, r.maxAccelError );
+                }
+            }
 
             static std::vector<const char*> types = { "sprite", "cube", "pyramid" };
             int t = (int)mParticleType;
@@ -1240,9 +3229,9 @@ void ComputeParticles::updateUI()
                 initSolids();
                 initRenderParticlePSO();
             }
+            im::DragInt( "seed", &mParticleSeed, 0.2f, 0, INT_MAX );
             if( im::Button( "init particle buffers" ) || im::Shortcut( ImGuiKey_I, 0, ImGuiInputFlags_RouteGlobal ) ) {
                 initParticleBuffers();
-                initSolids(); // TODO: this is needed to update the ParticleAttribs var, try just setting that on mParticleSolid
             }
 
 #if DEBUG_PARTICLE_BUFFERS
@@ -1250,24 +3239,26 @@ void ComputeParticles::updateUI()
             if( mDebugCopyParticles ) {
                 im::Indent();
                 im::Checkbox( "ParticleAttribs", &DebugShowParticleAttribsWindow );
-                im::Checkbox( "ParticleLists", &DebugShowParticleListssWindow );
+                im::Checkbox( "ParticleGrid", &DebugShowParticleGridWindow );
+                im::DragInt( "start", &mDebugParticlesStart, 1.0f, 0, mParticleConstants.numParticles - 1 );
+                im::SliderInt( "count", &mDebugParticlesCount, 1, MaxDebugParticles );
                 im::Unindent();
             }
 #endif
             im::Separator();
             im::Text( "Flocking" );            
-            ImGui::DragFloatRange2("speed", &mParticleConstants.speedMinMax.x, &mParticleConstants.speedMinMax.y, 0.02f, 0.0f, 100.0f, "min: %6.3f", "max: %6.3f", ImGuiSliderFlags_AlwaysClamp);
-            im::DragFloat( "separation", &mParticleConstants.separation, 0.001f, 0.0002f, 2.0f );
-            im::DragFloat( "alignment", &mParticleConstants.alignment, 0.001f, 0.0002f, 2.0f );
-            im::DragFloat( "cohesion", &mParticleConstants.cohesion, 0.001f, 0.0002f, 2.0f );
+            mParticleConstantsDirty |= ImGui::DragFloatRange2("speed", &mParticleConstants.speedMinMax.x, &mParticleConstants.speedMinMax.y, 0.02f, 0.0f, 100.0f, "min: %6.3f", "max: %6.3f", ImGuiSliderFlags_AlwaysClamp);
+            mParticleConstantsDirty |= im::DragFloat( "separation", &mParticleConstants.separation, 0.001f, 0.0002f, 2.0f );
+            mParticleConstantsDirty |= im::DragFloat( "alignment", &mParticleConstants.alignment, 0.001f, 0.0002f, 2.0f );
+            mParticleConstantsDirty |= im::DragFloat( "cohesion", &mParticleConstants.cohesion, 0.001f, 0.0002f, 2.0f );
 
             // TODO: make sure dists for separation < align < cohesion
-            im::DragFloat( "separation dist", &mParticleConstants.separationDist, 0.001f, 0.0f, 100.0f );
-            im::DragFloat( "alignment dist", &mParticleConstants.alignmentDist, 0.001f, 0.0f, 100.0f );
-            im::DragFloat( "cohesion dist", &mParticleConstants.cohesionDist, 0.001f, 0.0f, 100.0f );
+            mParticleConstantsDirty |= im::DragFloat( "separation dist", &mParticleConstants.separationDist, 0.001f, 0.0f, 100.0f );
+            mParticleConstantsDirty |= im::DragFloat( "alignment dist", &mParticleConstants.alignmentDist, 0.001f, 0.0f, 100.0f );
+            mParticleConstantsDirty |= im::DragFloat( "cohesion dist", &mParticleConstants.cohesionDist, 0.001f, 0.0f, 100.0f );
 
-            im::DragFloat( "sdf avoid strength", &mParticleConstants.sdfAvoidStrength, 0.01f, 0.0f, 100000.0f );
-            im::DragFloat( "sdf avoid distance", &mParticleConstants.sdfAvoidDistance, 0.001f, 0.0f, 100.0f );
+            mParticleConstantsDirty |= im::DragFloat( "sdf avoid strength", &mParticleConstants.sdfAvoidStrength, 0.01f, 0.0f, 100000.0f );
+            mParticleConstantsDirty |= im::DragFloat( "sdf avoid distance", &mParticleConstants.sdfAvoidDistance, 0.001f, 0.0f, 100.0f );
         }
 
         if( im::CollapsingHeader( "Camera", ImGuiTreeNodeFlags_DefaultOpen ) ) {
@@ -1335,13 +3326,30 @@ void ComputeParticles::updateUI()
             if( im::DragFloat2( "bg size", &bgSize.x, 0.02f ) ) {
                 mBackgroundCanvas->setSize( bgSize );
             }
+            static std::vector<const char*> bgResolutions = { "full", "1/2", "1/4" };
+            int bgResolution = mBackgroundCanvas->getResolutionScale() >= 4 ? 2 : mBackgroundCanvas->getResolutionScale() - 1;
+            if( im::Combo( "bg resolution", &bgResolution, bgResolutions.data(), (int)bgResolutions.size() ) ) {
+                mBackgroundCanvas->setResolutionScale( 1 << bgResolution );
+            }
+            bool bgTemporalCache = mBackgroundCanvas->getTemporalCache();
+            if( im::Checkbox( "bg temporal cache", &bgTemporalCache ) ) {
+                mBackgroundCanvas->setTemporalCache( bgTemporalCache );
+            }
+            bool bgConePrepass = mBackgroundCanvas->getConePrepass();
+            if( im::Checkbox( "bg cone prepass", &bgConePrepass ) ) {
+                mBackgroundCanvas->setConePrepass( bgConePrepass );
+            }
+            im::Checkbox( "bg iteration heatmap", &mBackgroundShowIterations );
+            im::Text( "bg output: %s", mBackgroundCanvas->isOutputCached() ? "reused" : "rendered" );
         }
 
         if( im::CollapsingHeader( "Post Process", ImGuiTreeNodeFlags_DefaultOpen ) ) {
             bool glowEnabled = mPostProcessConstants.glowEnabled;
+            im::BeginDisabled( ! mDownsampler );
             if( im::Checkbox( "glow", &glowEnabled ) ) {
                 mPostProcessConstants.glowEnabled = int(glowEnabled);
             }
+            im::EndDisabled();
             im::DragFloat( "glow intensity", &mPostProcessConstants.glowIntensity, 0.002f, 0.0001f, 10.0f );
 
             bool fogEnabled = mPostProcessConstants.fogEnabled;
@@ -1391,8 +3399,11 @@ void ComputeParticles::updateDebugParticleDataUI()
     if( DebugShowParticleAttribsWindow && im::Begin( "ParticleAttribs", &DebugShowParticleAttribsWindow ) ) {
         im::Text( "count: %d", mParticleConstants.numParticles );
 
-        if( ! DebugParticleAttribsData.empty() ) {
-            static int maxRows = 1000;
+        if( ! DebugParticleStateData.positions.empty() && ! DebugParticleAttribsData.empty() ) {
+            // streams are consumed independently, only show rows that all of them have
+            const int numRows = int( std::min( { DebugParticleStateData.positions.size(), DebugParticleStateData.velocities.size(),
+                                                 DebugParticleStateData.forces.size(), DebugParticleAttribsData.size() } ) );
+            im::Text( "showing particles [%d, %d)", DebugParticleAttribsStart, DebugParticleAttribsStart + numRows );
 
             static ImGuiTableFlags flags = ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV | ImGuiTableFlags_Hideable;
             flags |= ImGuiTableFlags_ScrollY;
@@ -1401,7 +3412,7 @@ void ComputeParticles::updateDebugParticleDataUI()
             if( im::BeginTable( "table_ParticleAttribs", 12, flags ) ) {
                 ImGuiTableColumnFlags columnFlags = ImGuiTableColumnFlags_WidthFixed; 
                 im::TableSetupScrollFreeze( 0, 1 ); // Make top row always visible
-                im::TableSetupColumn( "index", columnFlags, 34 );
+                im::TableSetupColumn( "index", columnFlags, 60 );
                 im::TableSetupColumn( "pos", columnFlags, 180 );
                 im::TableSetupColumn( "vel", columnFlags, 180 );
                 im::TableSetupColumn( "accel", columnFlags, 180 );
@@ -1416,24 +3427,27 @@ void ComputeParticles::updateDebugParticleDataUI()
                 im::TableHeadersRow();
 
                 ImGuiListClipper clipper;
-                clipper.Begin( std::min( maxRows, mParticleConstants.numParticles ) );
+                clipper.Begin( numRows );
                 while( clipper.Step() ) {
                     for( int row = clipper.DisplayStart; row<clipper.DisplayEnd; row++ ) {
                         im::TableNextRow();
+                        const float4 &pos = DebugParticleStateData.positions.at( row );
+                        const float4 &vel = DebugParticleStateData.velocities.at( row );
+                        const float4 &force = DebugParticleStateData.forces.at( row );
                         const auto &p = DebugParticleAttribsData.at( row );
                         int column = 0;
                         im::TableSetColumnIndex( column++ );
-                        im::Text( "%d", row );
+                        im::Text( "%d", DebugParticleAttribsStart + row );
                         im::TableSetColumnIndex( column++ );
-                        im::Text( "[%6.3f, %6.3f, %6.3f]", p.pos.x, p.pos.y, p.pos.z );
+                        im::Text( "[%6.3f, %6.3f, %6.3f]", pos.x, pos.y, pos.z );
                         im::TableSetColumnIndex( column++ );
-                        im::Text( "[%6.3f, %6.3f, %6.3f]", p.vel.x, p.vel.y, p.vel.z );
+                        im::Text( "[%6.3f, %6.3f, %6.3f]", vel.x, vel.y, vel.z );
                         im::TableSetColumnIndex( column++ );
-                        im::Text( "[%6.3f, %6.3f, %6.3f]", p.accel.x, p.accel.y, p.accel.z );
+                        im::Text( "[%6.3f, %6.3f, %6.3f]", force.x, force.y, force.z );
                         im::TableSetColumnIndex( column++ );
-                        im::Text( " %d", p.numInteractions );
+                        im::Text( " %d", int( force.w ) );
                         im::TableSetColumnIndex( column++ );
-                        im::Text( "%0.03f", p.temperature );
+                        im::Text( "%0.03f", vel.w );
                         im::TableSetColumnIndex( column++ );
                         im::Text( "%0.03f", p.distToSDF );
                         im::TableSetColumnIndex( column++ );
@@ -1458,45 +3472,49 @@ void ComputeParticles::updateDebugParticleDataUI()
     im::SetNextWindowPos( { 500, 40 }, ImGuiCond_FirstUseEver );
     im::SetNextWindowSize( { 600, 600 }, ImGuiCond_FirstUseEver );
 
-    if( DebugShowParticleListssWindow && im::Begin( "ParticleLists", &DebugShowParticleListssWindow ) ) {
-        // TODO: show either as a table or tree
+    if( DebugShowParticleGridWindow && im::Begin( "ParticleGrid", &DebugShowParticleGridWindow ) ) {
+        im::Text( "grid size: [%d, %d, %d]", mParticleConstants.gridSize.x, mParticleConstants.gridSize.y, mParticleConstants.gridSize.z );
 
-        if( ! DebugParticleListsData.empty() && ! DebugParticleListsHeadData.empty() ) {
-            static int maxRows = 1000;
+        if( ! DebugParticleCellsData.empty() && ! DebugSortedParticleIdsData.empty() ) {
+            const int numRows = int( std::min( DebugParticleCellsData.size(), DebugSortedParticleIdsData.size() ) );
+            im::Text( "showing particles [%d, %d)", DebugParticleGridStart, DebugParticleGridStart + numRows );
 
             static ImGuiTableFlags flags = ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV | ImGuiTableFlags_Hideable;
             flags |= ImGuiTableFlags_ScrollY;
             flags |= ImGuiTableFlags_SizingFixedFit;
 
-            if( im::BeginTable( "table_ParticleAttribs", 3, flags ) ) {
+            if( im::BeginTable( "table_ParticleGrid", 4, flags ) ) {
                 ImGuiTableColumnFlags columnFlags = ImGuiTableColumnFlags_WidthFixed; 
                 im::TableSetupScrollFreeze( 0, 1 ); // Make top row always visible
                 im::TableSetupColumn( "index", columnFlags, 40 );
-                im::TableSetupColumn( "head", columnFlags, 40 );
-                im::TableSetupColumn( "next", columnFlags, 40 );
+                im::TableSetupColumn( "cell", columnFlags, 50 );
+                im::TableSetupColumn( "index in cell", columnFlags, 50 );
+                im::TableSetupColumn( "sorted id", columnFlags, 50 );
                 im::TableHeadersRow();
 
                 ImGuiListClipper clipper;
-                clipper.Begin( std::min( maxRows, mParticleConstants.numParticles ) );
+                clipper.Begin( numRows );
                 while( clipper.Step() ) {
                     for( int row = clipper.DisplayStart; row<clipper.DisplayEnd; row++ ) {
                         im::TableNextRow();
-                        int headIndex = DebugParticleListsHeadData.at( row );
-                        int nextIndex = DebugParticleListsData.at( row );
+                        const int2 &cell = DebugParticleCellsData.at( row );
+                        int sortedId = DebugSortedParticleIdsData.at( row );
                         int column = 0;
                         im::TableSetColumnIndex( column++ );
-                        im::Text( "%d", row );
+                        im::Text( "%d", DebugParticleGridStart + row );
                         im::TableSetColumnIndex( column++ );
-                        im::Text( "%d", headIndex );
+                        im::Text( "%d", cell.x );
                         im::TableSetColumnIndex( column++ );
-                        im::Text( "%d", nextIndex );
+                        im::Text( "%d", cell.y );
+                        im::TableSetColumnIndex( column++ );
+                        im::Text( "%d", sortedId );
                     }
                 }
                 im::EndTable();
             }
         }
 
-        im::End(); // ParticleAttribs
+        im::End(); // ParticleGrid
     }
 
 }
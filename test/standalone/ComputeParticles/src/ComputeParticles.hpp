@@ -8,10 +8,17 @@
 #include "juniper/Juniper.h"
 #include "juniper/Canvas.h"
 #include "juniper/post/aa/FXAA.h"
+#include "juniper/post/Downsampler.h"
 #include "juniper/Profiler.h"
+#include "juniper/ReadbackBuffer.h"
+#include "juniper/SimulationClock.h"
 //#include "juniper/Solids.h"
 #include "SolidsOriginal.h"
 
+#include "ParticleSimCpu.h"
+
+#include <fstream>
+
 #define DEBUG_PARTICLE_BUFFERS 1
 
 namespace dg = Diligent;
@@ -29,6 +36,7 @@ public:
     ComputeParticles();
 
     virtual void ModifyEngineInitInfo(const ModifyEngineInitInfoAttribs& Attribs) override final;
+    virtual CommandLineStatus ProcessCommandLine(int argc, const char* const* argv) override final;
     virtual void Initialize(const dg::SampleInitInfo& InitInfo) override final;
     virtual void WindowResize(dg::Uint32 Width, dg::Uint32 Height) override final;
     virtual void Update(double CurrTime, double ElapsedTime) override final;
@@ -37,9 +45,37 @@ public:
     virtual const dg::Char* GetSampleName() const override final { return "ComputeParticles"; }
 
 private:
+    // The particle update can also run on the CPU (cpusim/), for validating the compute shaders or when they aren't supported
+    enum SimulationBackend {
+        Gpu,
+        Cpu
+    };
+
+    // Simulation kernels that get their own THREAD_GROUP_SIZE, see tuneThreadGroupSizes()
+    enum ParticleKernel {
+        KernelResetGridCells,
+        KernelMoveParticles,
+        KernelPrefixSumCells,
+        KernelScatterParticles,
+        KernelInteractParticles,
+        KernelSortParticles, // Morton keys and the radix sort passes, which share the per block digit counts layout
+        NumParticleKernels
+    };
+
     void initRenderParticlePSO();
+    void initRenderParticleSRBs();
     void initUpdateParticlePSO();
     void initParticleBuffers();
+    void createParticleBuffers( int capacity );
+    void spawnParticles( int first, int count );
+    void resizeParticles( int numParticles );
+    void initGridBuffers();
+    void initVerletBuffers();
+    void updateGridSize();
+    void initUpdateParticleSRBs();
+    void tuneThreadGroupSizes( bool useCache );
+    bool fitThreadGroupSizes( int numParticles );
+    dg::IQuery* getKernelTimingQuery( ParticleKernel kernel ) const { return mTimedKernel == kernel ? mKernelTimingQuery.RawPtr() : nullptr; }
     void initConsantBuffers();
     void initCamera();
     void initSolids();
@@ -48,23 +84,114 @@ private:
     void watchShadersDir();
     void checkReloadOnAssetsUpdated();
 
+    void uploadParticleConstants();
     void updateParticles();
+    void waitForAsyncSimulation();
+    void updateParticlesGpu( bool reorder );
+    void updateVerletLists();
+    void growVerletLists();
+    void readVerletState( bool stepped );
+    bool sortParticlesByMortonCode();
+    void initSdfVolume();
+    void bakeSdfVolume();
+    void updateParticlesCpu();
+    void setSimulationBackend( SimulationBackend backend );
+    void validateCpuSimulation();
+    cpusim::ParticleConstants getCpuSimConstants() const;
     void drawParticles();
+    bool cullParticles();
     void drawBackgroundCanvas();
     void updateDebugParticleDataUI();
 
+    void startBenchmark();
+    void applyBenchmarkConfig();
+    void updateBenchmark( double elapsedTime );
+
     RefCntAutoPtr<dg::IPipelineState>         mRenderParticlePSO;
-    RefCntAutoPtr<dg::IShaderResourceBinding> mRenderParticleSRB;
-    RefCntAutoPtr<dg::IPipelineState>         mResetParticleListsPSO;
-    RefCntAutoPtr<dg::IShaderResourceBinding> mResetParticleListsSRB;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mRenderParticleSRBs[2];    // one per particle state buffer
+    RefCntAutoPtr<dg::IPipelineState>         mResetGridCellsPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mResetGridCellsSRB;
     RefCntAutoPtr<dg::IPipelineState>         mMoveParticlesPSO;
-    RefCntAutoPtr<dg::IShaderResourceBinding> mMoveParticlesSRB;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mMoveParticlesSRBs[2];     // [i] reads state i, writes state 1 - i
+    RefCntAutoPtr<dg::IPipelineState>         mMoveReorderParticlesPSO;  // move pass that also gathers particles into Morton order
+    RefCntAutoPtr<dg::IShaderResourceBinding> mMoveReorderParticlesSRBs[2];
+    RefCntAutoPtr<dg::IPipelineState>         mPrefixSumCellsPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mPrefixSumCellsSRB;
+    RefCntAutoPtr<dg::IPipelineState>         mScatterParticlesPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mScatterParticlesSRB;
+    RefCntAutoPtr<dg::IPipelineState>         mAggregateCellsPSO;        // per-cell center of mass and heading, only with mFarField
+    RefCntAutoPtr<dg::IShaderResourceBinding> mAggregateCellsSRBs[2];    // [i] reads state i
     RefCntAutoPtr<dg::IPipelineState>         mInteractParticlesPSO;
-    RefCntAutoPtr<dg::IShaderResourceBinding> mInteractParticlesSRB;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mInteractParticlesSRBs[2]; // [i] reads state i
+    RefCntAutoPtr<dg::IPipelineState>         mBakeSdfPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mBakeSdfSRB;
+    RefCntAutoPtr<dg::IPipelineState>         mMortonKeysPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mMortonKeysSRBs[2];        // [i] reads state i
+    RefCntAutoPtr<dg::IPipelineState>         mRadixSortCountPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mRadixSortCountSRBs[2];    // [i] reads keys i
+    RefCntAutoPtr<dg::IPipelineState>         mRadixSortScanPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mRadixSortScanSRB;
+    RefCntAutoPtr<dg::IPipelineState>         mRadixSortScatterPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mRadixSortScatterSRBs[2];  // [i] reads keys i, writes keys 1 - i
+    RefCntAutoPtr<dg::IPipelineState>         mCullParticlesPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mCullParticlesSRBs[2];     // [i] reads state i
+    RefCntAutoPtr<dg::IPipelineState>         mInitParticlesPSO;         // writes the initial state into buffers 0
+    RefCntAutoPtr<dg::IPipelineState>         mVerletDisplacementPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mVerletDisplacementSRBs[2]; // [i] reads state i
+    RefCntAutoPtr<dg::IPipelineState>         mVerletCheckPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mVerletCheckSRB;
+    RefCntAutoPtr<dg::IPipelineState>         mBuildVerletListsPSO;
+    RefCntAutoPtr<dg::IShaderResourceBinding> mBuildVerletListsSRBs[2];  // [i] reads state i
     RefCntAutoPtr<dg::IBuffer>                mParticleConstantsBuffer;
-    RefCntAutoPtr<dg::IBuffer>                mParticleAttribsBuffer;
-    RefCntAutoPtr<dg::IBuffer>                mParticleListsBuffer;
-    RefCntAutoPtr<dg::IBuffer>                mParticleListHeadsBuffer;
+    RefCntAutoPtr<dg::IBuffer>                mParticleFrameConstantsBuffer; // USAGE_DYNAMIC, immediate context only
+    // particle state is split into float4 streams so the neighbor loop only fetches what it reads.
+    // positions and velocities are double buffered, the move pass reads one and writes the other
+    RefCntAutoPtr<dg::IBuffer>                mParticlePositionsBuffers[2];  // xyz: position, w: size
+    RefCntAutoPtr<dg::IBuffer>                mParticleVelocitiesBuffers[2]; // xyz: velocity, w: temperature
+    int                                       mParticleStateIndex = 0;       // buffer holding the latest particle state
+    int                                       mParticleCapacity = 0;         // particles the buffers have room for, numParticles are active
+    bool                                      mPrevParticleStateValid = false; // other buffer holds the previous step (in the same order)
+    RefCntAutoPtr<dg::IBuffer>                mParticleForcesBuffer;     // xyz: acceleration, w: num interactions
+#if DEBUG_PARTICLE_BUFFERS
+    RefCntAutoPtr<dg::IBuffer>                mParticleDebugBuffer;      // sdf debug info, written by the interact pass
+#endif
+    // uniform grid, built each frame with a counting sort: count particles per cell -> prefix sum -> scatter
+    RefCntAutoPtr<dg::IBuffer>                mGridCellCountsBuffer;    // num particles per cell
+    RefCntAutoPtr<dg::IBuffer>                mGridCellOffsetsBuffer;   // exclusive prefix sum of counts
+    RefCntAutoPtr<dg::IBuffer>                mGridCellCentersBuffer;   // xyz: center of mass, w: num particles
+    RefCntAutoPtr<dg::IBuffer>                mGridCellHeadingsBuffer;  // xyz: mean normalized velocity
+    RefCntAutoPtr<dg::IBuffer>                mParticleCellsBuffer;     // per particle: (cell, index within cell)
+    RefCntAutoPtr<dg::IBuffer>                mSortedParticleIdsBuffer; // particle ids sorted by cell
+    // periodic Morton order reordering, so particles that are close in space are also close in memory
+    RefCntAutoPtr<dg::IBuffer>                mSortKeysBuffers[2];      // Morton code of each particle's cell
+    RefCntAutoPtr<dg::IBuffer>                mSortValuesBuffers[2];    // particle ids, [0] holds the sorted order
+    RefCntAutoPtr<dg::IBuffer>                mBlockDigitCountsBuffer;
+    RefCntAutoPtr<dg::IBuffer>                mBlockDigitOffsetsBuffer;
+    RefCntAutoPtr<dg::IBuffer>                mRadixSortConstantsBuffer;
+    RefCntAutoPtr<dg::IBuffer>                mParticleInitConstantsBuffer;
+    // frustum culling, the render pass draws VisibleParticleIds with the instance count in mDrawArgsBuffer
+    RefCntAutoPtr<dg::IBuffer>                mVisibleParticleIdsBuffer;
+    RefCntAutoPtr<dg::IBuffer>                mParticleTransformsBuffer; // per-instance mesh transforms, in the same order as the visible ids
+    RefCntAutoPtr<dg::IBuffer>                mDrawArgsBuffer;
+    RefCntAutoPtr<dg::IBuffer>                mCullConstantsBuffer;
+    std::unique_ptr<ju::ReadbackBuffer>       mDrawArgsReadback;
+    dg::Uint32                                mNumVisibleParticles = 0;
+    // verlet lists (binning mode 3), only allocated while that mode is selected
+    RefCntAutoPtr<dg::IBuffer>                mNeighborListsBuffer;     // mVerletMaxNeighbors ids per particle
+    RefCntAutoPtr<dg::IBuffer>                mNeighborCountsBuffer;
+    RefCntAutoPtr<dg::IBuffer>                mVerletPositionsBuffer;   // positions when the lists were built
+    RefCntAutoPtr<dg::IBuffer>                mVerletStateBuffer;       // max displacement and rebuild stats, see verlet_check.csh
+    RefCntAutoPtr<dg::IBuffer>                mVerletDispatchArgsBuffer; // indirect args for the rebuild passes, zero groups when not rebuilding
+    RefCntAutoPtr<dg::IBuffer>                mVerletConstantsBuffer;
+    std::unique_ptr<ju::ReadbackBuffer>       mVerletStateReadback;
+    bool                                      mVerletRebuildPending = true; // the lists don't match the particles, rebuild on the next step
+    dg::Uint32                                mVerletRebuilds = 0, mVerletSteps = 0;
+    float                                     mVerletMaxDisplacement = 0;
+    int                                       mVerletNeighborsOverflow = 0; // most neighbors any build found since the lists were created, when they didn't fit
+    // sdf_scene() baked over the world bounds, used for scene avoidance when SDF_VOLUME is enabled
+    RefCntAutoPtr<dg::ITexture>               mSdfVolume;               // xyz: normal, w: distance
+    float3                                    mSdfVolumeWorldMin, mSdfVolumeWorldMax; // bounds of the last bake
+    bool                                      mSdfVolumeDirty = true;
 
     // -------------------------------------------
     // Post Process
@@ -77,13 +204,11 @@ private:
     RefCntAutoPtr<dg::IBuffer>                mPostProcessConstantsBuffer;
     RefCntAutoPtr<dg::ITextureView>           mPostProcessRTV;
 
-    RefCntAutoPtr<dg::IPipelineState>         mDownSamplePSO;
-    static constexpr dg::Uint32               DownSampleFactor = 5;
-    RefCntAutoPtr<dg::IShaderResourceBinding> mDownSampleSRB[DownSampleFactor];
+    static constexpr dg::Uint32               DownSampleFactor = 5; // mip levels of GBuffer.Color used for glow
+    std::unique_ptr<juniper::post::Downsampler> mDownsampler; // null without compute shaders, glow is disabled then
 
     // Render to GBuffer
     struct GBuffer {
-        RefCntAutoPtr<dg::ITextureView> ColorRTVs[DownSampleFactor];
         RefCntAutoPtr<dg::ITexture>     Color;
         RefCntAutoPtr<dg::ITextureView> ColorSRBs[DownSampleFactor];
         RefCntAutoPtr<dg::ITexture>     Depth;
@@ -116,35 +241,55 @@ private:
 
 
 #if DEBUG_PARTICLE_BUFFERS
-    RefCntAutoPtr<dg::IBuffer>              mParticleAttribsStaging, mParticleListsStaging, mParticleListsHeadStaging;
-    RefCntAutoPtr<dg::IFence>               mFenceParticleAttribsAvailable;
-    dg::Uint64                                  mFenceParticleAttribsValue = 1; // Can't signal 0
+    std::unique_ptr<ju::ReadbackBuffer>     mParticlePositionsReadback, mParticleVelocitiesReadback, mParticleForcesReadback, mParticleDebugReadback;
+    std::unique_ptr<ju::ReadbackBuffer>     mParticleCellsReadback, mSortedParticleIdsReadback;
     bool    mDebugCopyParticles = false;
+    int     mDebugParticlesStart = 0;       // first particle index read back for the debug windows
+    int     mDebugParticlesCount = 1000;    // number of particles read back, up to MaxDebugParticles
 #endif
 
     bool        mUIEnabled = true;  
     float       mParticleScaleVariation = 0.1f;
     float       mParticleBirthPadding = 0.1f;
     float       mSimulationSpeed    = 1.35f;
+    ju::SimulationClock mSimulationClock{ 1.0 / 60.0, 8 };
+    bool        mInterpolateParticles = true;
     float       mParticleSpeedVariation = 0.1f;
-    int         mThreadGroupSize    = 256;
+    int         mParticleSeed       = 0;
+    int         mThreadGroupSize    = 256; // cull and init passes, the simulation kernels use mKernelGroupSizes
+    int         mKernelGroupSizes[NumParticleKernels] = { 256, 256, 256, 256, 256, 256 };
+    int         mTimedKernel        = -1; // while tuning, that kernel's dispatches are bracketed by mKernelTimingQuery
+    RefCntAutoPtr<dg::IQuery> mKernelTimingQuery;
+    int         mBinningMode        = 1; // 0: brute force, 1: uniform grid, 2: tiled brute force, 3: verlet lists (see BINNING_MODE in interact_particles.csh)
+    float       mVerletSkin         = 0.3f; // extra radius the verlet lists are built with
+    int         mVerletMaxNeighbors = 32; // ids per neighbor list, grown by growVerletLists()
+    int         mMaxGridCellsPerAxis = 128;
+    bool        mAvoidSdf           = true; // PARTICLES_AVOID_SDF in interact_particles.csh
+    bool        mFarField           = false; // PARTICLES_FAR_FIELD, only applies to the uniform grid
+    bool        mUseSdfVolume       = true;
+    int         mSdfVolumeResolution = 64; // texels per axis
+    int         mReorderInterval    = 60; // steps between Morton order sorts, 0: disabled
+    int         mStepsSinceReorder  = 0;
     float       mTime               = 0;
     float       mTimeDelta          = 0;
     bool        mDrawBackground     = true;
+    bool        mBackgroundShowIterations = false; // sphere tracing heatmap instead of shading
     bool        mDrawTestSolid      = false;
     bool        mDrawParticles      = true;
+    bool        mCullParticles      = true;
     bool        mUpdateParticles    = true;
+    bool        mAsyncCompute       = true; // simulate on mComputeContext, overlapping the next frame's rendering
+    float       mFrameTimeMs[2]     = {}; // smoothed frame time with async compute off / on
 
+    // sizes and tuning parameters, uploaded by uploadParticleConstants() only when mParticleConstantsDirty is set
     struct ParticleConstants {
-        float4x4 viewProj;
-
         int     numParticles;
-        float   time;
         float   deltaTime;
         float   separation;
+        float   scale;
 
         int3    gridSize;
-        float   scale;
+        float   farFieldDist;
 
         float2  speedMinMax;
         float   alignment;
@@ -159,12 +304,30 @@ private:
         float   sdfAvoidDistance;
 
         float3  worldMax;
-        float   padding2;
+        float   padding = 0;
+    };
+    // written to a dynamic buffer once per frame, only the drawing passes read it
+    struct ParticleFrameConstants {
+        float4x4 viewProj;
+        float   time;
+        float   interpolationAlpha; // blend from previous to current positions when drawing
+        float2  padding;
     };
     static_assert(sizeof(ParticleConstants) % 16 == 0, "must be aligned to 16 bytes");
     ParticleConstants mParticleConstants;
+    bool              mParticleConstantsDirty = true;
 
     std::unique_ptr<ju::Canvas> mBackgroundCanvas;
+    // last frame's background constants, the camera is reprojected by the canvas' temporal cache and anything else invalidates it
+    struct BackgroundHistory {
+        float4x4    viewProj;
+        float4x4    inverseViewProj;
+        float3      camPos;
+        float3      lightDir, fogColor, worldMin, worldMax;
+        bool        showIterations = false;
+        bool        valid = false;
+    };
+    BackgroundHistory           mBackgroundHistory;
     std::unique_ptr<ju::Solid>   mTestSolid, mParticleSolid;
 
     dg::float4x4                mViewProjMatrix;
@@ -179,6 +342,39 @@ private:
 
     ParticleType mParticleType = ParticleType::Pyramid;
 
+    SimulationBackend                           mSimulationBackend = SimulationBackend::Gpu;
+    bool                                        mComputeShadersSupported = true;
+    std::unique_ptr<cpusim::ParticleSimCpu>     mParticleSimCpu;
+    bool                                        mValidateCpuSimulation = false; // set from UI, runs on the next update
+    cpusim::CompareResult                       mCpuValidationResult;
+
+    // Async compute: the simulation is recorded on mComputeContext after the particles are drawn, the graphics
+    // context waits on mComputeFence before the next frame touches particle buffers
+    RefCntAutoPtr<dg::IDeviceContext>           mComputeContext; // null if there's no separate compute queue
+    dg::IDeviceContext*                         mSimContext = nullptr; // context the current simulation step records to
+    dg::Uint64                                  mSimContextMask = 1; // ImmediateContextMask for resources the simulation uses
+    RefCntAutoPtr<dg::IFence>                   mGraphicsFence, mComputeFence;
+    dg::Uint64                                  mGraphicsFenceValue = 0, mComputeFenceValue = 0;
+
+    // Unattended sweep over particle counts and simulation settings, enabled with --bench <file.csv>
+    struct BenchmarkConfig {
+        int     numParticles;
+        int     threadGroupSize;
+        int     binningMode;
+        bool    avoidSdf;
+    };
+    struct Benchmark {
+        std::string                     outputPath;
+        std::ofstream                   csv;
+        int                             warmupFrames = 60;
+        int                             measuredFrames = 300;
+        std::vector<BenchmarkConfig>    configs;
+        size_t                          configIndex = 0;
+        int                             frame = 0;
+        double                          cpuFrameSeconds = 0; // summed over the measured frames
+    };
+    std::unique_ptr<Benchmark>      mBenchmark;
+
     std::unique_ptr<ju::Profiler>   mProfiler;
     bool                            mProfilingUIEnabled = true;
 };
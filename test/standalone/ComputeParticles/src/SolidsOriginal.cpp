@@ -1,10 +1,12 @@
 // Based on Tutorial02_Cube.cpp
 
+#include <cstring>
 #include <filesystem>
 
 #include "SolidsOriginal.h"
 #include "MapHelper.hpp"
 #include "GraphicsTypesX.hpp"
+#include "ShaderMacroHelper.hpp"
 
 #include "juniper/AppGlobal.h"
 
@@ -55,12 +57,24 @@ Solid::~Solid()
 {
 }
 
-//void Cube::setShaderResourceVar( dg::SHADER_TYPE shaderType, const dg::Char* name, dg::IDeviceObject* object )
-//{
-//    if( mSRB ) {
-//        mSRB->GetVariableByName( shaderType, name )->Set( object );
-//    }
-//}
+void Solid::setShaderResourceVar( dg::SHADER_TYPE shaderType, const dg::Char* name, dg::IDeviceObject* object )
+{
+    // keep the options in sync so the var is restored when the PSO is rebuilt after a shader reload
+    for( auto &var : mOptions.shaderResourceVars ) {
+        if( ( var.desc.ShaderStages & shaderType ) != 0 && strcmp( var.desc.Name, name ) == 0 ) {
+            var.object = object;
+        }
+    }
+
+    if( mSRB ) {
+        if( auto var = mSRB->GetVariableByName( shaderType, name ) ) {
+            var->Set( object );
+        }
+        else {
+            LOG_WARNING_MESSAGE( __FUNCTION__, "|(", mOptions.name, ") Failed to set shader var with name: ", name, ", shader type: ", shaderType );
+        }
+    }
+}
 
 void Solid::initPipelineState()
 {
@@ -84,6 +98,13 @@ void Solid::initPipelineState()
     ShaderCI.Desc.UseCombinedTextureSamplers = true;
     ShaderCI.pShaderSourceStreamFactory = global()->shaderSourceFactory;
 
+    ShaderMacroHelper macros;
+    for( const auto &macro : mOptions.macros ) {
+        macros.AddShaderMacro( macro.first.c_str(), macro.second );
+    }
+    macros.Finalize();
+    ShaderCI.Macros = macros;
+
     RefCntAutoPtr<IShader> vertShader;
     {
         auto filePathStr = mOptions.vertPath.string();
@@ -280,10 +301,10 @@ void Solid::update( double deltaSeconds )
     }
 }
 
-void Solid::draw( IDeviceContext* context, const float4x4 &viewProjectionMatrix, uint32_t numInstances )
+bool Solid::prepareDraw( IDeviceContext* context, const float4x4 &viewProjectionMatrix )
 {
     if( ! mPSO || ! mSRB ) {
-        return;
+        return false;
     }
 
     // Update constant buffer
@@ -309,6 +330,14 @@ void Solid::draw( IDeviceContext* context, const float4x4 &viewProjectionMatrix,
     // Commit shader resources. RESOURCE_STATE_TRANSITION_MODE_TRANSITION mode
     // makes sure that resources are transitioned to required states.
     context->CommitShaderResources( mSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION );
+    return true;
+}
+
+void Solid::draw( IDeviceContext* context, const float4x4 &viewProjectionMatrix, uint32_t numInstances )
+{
+    if( ! prepareDraw( context, viewProjectionMatrix ) ) {
+        return;
+    }
 
     DrawIndexedAttribs DrawAttrs;     // This is an indexed draw call
     DrawAttrs.IndexType  = VT_UINT32; // Index type
@@ -319,6 +348,22 @@ void Solid::draw( IDeviceContext* context, const float4x4 &viewProjectionMatrix,
     context->DrawIndexed( DrawAttrs );
 }
 
+void Solid::drawIndirect( IDeviceContext* context, const float4x4 &viewProjectionMatrix, IBuffer* indirectArgs, Uint64 argsOffset )
+{
+    if( ! prepareDraw( context, viewProjectionMatrix ) ) {
+        return;
+    }
+
+    // args are { NumIndices, NumInstances, FirstIndexLocation, BaseVertex, FirstInstanceLocation }, NumIndices should be getNumIndices()
+    DrawIndexedIndirectAttribs DrawAttrs;
+    DrawAttrs.pAttribsBuffer = indirectArgs;
+    DrawAttrs.DrawArgsOffset = argsOffset;
+    DrawAttrs.IndexType      = VT_UINT32;
+    DrawAttrs.Flags          = DRAW_FLAG_VERIFY_ALL;
+    DrawAttrs.AttribsBufferStateTransitionMode = RESOURCE_STATE_TRANSITION_MODE_TRANSITION;
+    context->DrawIndexedIndirect( DrawAttrs );
+}
+
 // --------------------------------------------------------------------------------------------------
 // Cube
 // --------------------------------------------------------------------------------------------------
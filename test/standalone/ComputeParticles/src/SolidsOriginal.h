@@ -55,23 +55,29 @@ public:
 
 		std::vector<ShaderResourceVar>	shaderResourceVars;
 		std::vector<StaticShaderVar>	staticShaderVars;
+		std::vector<std::pair<std::string, int>>	macros; // defined for both the vertex and pixel shader
 
 		//std::function<void>	oReInitFn;
 	};
 	Solid( const Options &options = Options() );
 	virtual ~Solid();
 
-	// this is used for the structured buffer (ParticleAttribs), which is set after the SRB is already constructed.
-	//void setShaderResourceVar( dg::SHADER_TYPE shaderType, const dg::Char* name, dg::IDeviceObject* object );
+	//! Sets a var that was passed in Options::shaderResourceVars after the SRB is constructed. Use SHADER_RESOURCE_VARIABLE_TYPE_DYNAMIC for vars that change every frame.
+	void setShaderResourceVar( dg::SHADER_TYPE shaderType, const dg::Char* name, dg::IDeviceObject* object );
 
 	virtual void update( double deltaSeconds );
 	virtual void draw( dg::IDeviceContext* context, const dg::float4x4 &viewProjectionMatrix, uint32_t numInstances = 1 );
+	//! Draws with instance counts etc. read from indirectArgs on the gpu (ex. written by a culling pass)
+	virtual void drawIndirect( dg::IDeviceContext* context, const dg::float4x4 &viewProjectionMatrix, dg::IBuffer* indirectArgs, dg::Uint64 argsOffset = 0 );
+
+	dg::Uint32	getNumIndices() const	{ return mNumIndices; }
 
 	void setTransform( const dg::float4x4 &m )	{ mTransform = m; }
 
 	void setLightDir( const dg::float3 &dir )	{ mLightDirection = dir; }
 
 protected:
+	bool prepareDraw( dg::IDeviceContext* context, const dg::float4x4 &viewProjectionMatrix );
 	void initPipelineState();
 	void initVertexBuffer( const std::vector<dg::float3> &positions, const std::vector<dg::float2> &texcoords, const std::vector<dg::float3> &normals );
 	void initIndexBuffer( const std::vector<dg::Uint32> &indices );